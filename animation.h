@@ -0,0 +1,201 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include "scene.h"
+#include "simulation.h"
+#include "threadpool.h"
+
+// CPU-side animation and transform math of the render loop, independent of OpenGL so
+// it can be measured on its own (animation_bench.cpp): the circular orbits that move
+// the scene's pivot nodes, translate/scale node matrices and the mouse-look camera.
+//
+// The renderer evaluates its few orbits one at a time. The batch kernels below cover
+// large populations in scalar, SSE2 and AVX2 versions selected by SimdLevel, like the
+// Kepler kernels in simulation.h, and split the work across a ThreadPool when given one.
+
+// Circular orbit animating the translation of a pivot node
+struct Orbit
+{
+    int node;
+    float radius;
+    float speed;
+    float height;
+};
+
+inline glm::vec3 orbitPosition(const Orbit& orbit, float time)
+{
+    return glm::vec3(sin(time * orbit.speed) * orbit.radius, orbit.height, cos(time * orbit.speed) * orbit.radius);
+}
+
+// Mouse look: turns the cursor movement into yaw and pitch (degrees), keeping the
+// pitch off the poles where the view direction would flip
+inline void applyMouseLook(float& yaw, float& pitch, float xoffset, float yoffset, float sensitivity = 0.1f)
+{
+    yaw += xoffset * sensitivity;
+    pitch += yoffset * sensitivity;
+    pitch = std::min(std::max(pitch, -89.0f), 89.0f);
+}
+
+inline glm::vec3 lookDirection(float yaw, float pitch)
+{
+    glm::vec3 front;
+    front.x = cos(glm::radians(yaw)) * cos(glm::radians(pitch));
+    front.y = sin(glm::radians(pitch));
+    front.z = sin(glm::radians(yaw)) * cos(glm::radians(pitch));
+    return glm::normalize(front);
+}
+
+// ---------------------------------------------------------------------------
+// Orbit kernels. Each evaluates orbits [begin, end) at the given time:
+//   x = r sin(speed t), y = height, z = r cos(speed t)
+
+// Structure-of-arrays orbits for the batch kernels
+struct OrbitArrays
+{
+    std::vector<float> radius;
+    std::vector<float> speed;
+    std::vector<float> height;
+
+    // Positions written by the kernels
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+
+    size_t size() const { return radius.size(); }
+};
+
+inline void orbitsScalar(OrbitArrays& o, size_t begin, size_t end, float time)
+{
+    for (size_t i = begin; i < end; ++i)
+    {
+        float angle = o.speed[i] * time;
+        o.x[i] = o.radius[i] * std::sin(angle);
+        o.y[i] = o.height[i];
+        o.z[i] = o.radius[i] * std::cos(angle);
+    }
+}
+
+#ifdef SIMULATION_X86
+inline void orbitsSSE2(OrbitArrays& o, size_t begin, size_t end, float time)
+{
+    const __m128 t = _mm_set1_ps(time);
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4)
+    {
+        __m128 s, c;
+        sincosSSE2(_mm_mul_ps(_mm_loadu_ps(&o.speed[i]), t), &s, &c);
+        __m128 radius = _mm_loadu_ps(&o.radius[i]);
+        _mm_storeu_ps(&o.x[i], _mm_mul_ps(radius, s));
+        _mm_storeu_ps(&o.y[i], _mm_loadu_ps(&o.height[i]));
+        _mm_storeu_ps(&o.z[i], _mm_mul_ps(radius, c));
+    }
+    orbitsScalar(o, i, end, time);
+}
+
+#ifdef SIMULATION_AVX2
+SIMULATION_TARGET_AVX2 inline void orbitsAVX2(OrbitArrays& o, size_t begin, size_t end, float time)
+{
+    const __m256 t = _mm256_set1_ps(time);
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8)
+    {
+        __m256 s, c;
+        sincosAVX2(_mm256_mul_ps(_mm256_loadu_ps(&o.speed[i]), t), &s, &c);
+        __m256 radius = _mm256_loadu_ps(&o.radius[i]);
+        _mm256_storeu_ps(&o.x[i], _mm256_mul_ps(radius, s));
+        _mm256_storeu_ps(&o.y[i], _mm256_loadu_ps(&o.height[i]));
+        _mm256_storeu_ps(&o.z[i], _mm256_mul_ps(radius, c));
+    }
+    orbitsSSE2(o, i, end, time);
+}
+#endif // SIMULATION_AVX2
+#endif // SIMULATION_X86
+
+inline void orbitsKernel(SimdLevel level, OrbitArrays& o, size_t begin, size_t end, float time)
+{
+#ifdef SIMULATION_AVX2
+    if (level == SimdAVX2)
+    {
+        orbitsAVX2(o, begin, end, time);
+        return;
+    }
+#endif
+#ifdef SIMULATION_X86
+    if (level >= SimdSSE2)
+    {
+        orbitsSSE2(o, begin, end, time);
+        return;
+    }
+#endif
+    orbitsScalar(o, begin, end, time);
+}
+
+inline void updateOrbits(OrbitArrays& o, float time, SimdLevel level, ThreadPool* pool = nullptr, size_t minChunk = 4096)
+{
+    if (!pool)
+    {
+        orbitsKernel(level, o, 0, o.size(), time);
+        return;
+    }
+    pool->parallelFor(o.size(), minChunk, [&](size_t begin, size_t end) { orbitsKernel(level, o, begin, end, time); });
+}
+
+// ---------------------------------------------------------------------------
+// Translate/scale matrix kernels. Each writes matrices [begin, end). The scalar one
+// is translateScale() from scene.h, two full glm matrix products per node; the SSE2
+// one stores the four columns directly, since the product only puts the scale on the
+// diagonal and the translation in column 3.
+
+inline void translateScaleScalar(const glm::vec3* translation, const glm::vec3* scale, glm::mat4* out, size_t begin, size_t end)
+{
+    for (size_t i = begin; i < end; ++i)
+        out[i] = translateScale(translation[i], scale[i]);
+}
+
+#ifdef SIMULATION_X86
+inline void translateScaleSSE2(const glm::vec3* translation, const glm::vec3* scale, glm::mat4* out, size_t begin, size_t end)
+{
+    for (size_t i = begin; i < end; ++i)
+    {
+        float* m = &out[i][0][0];
+        _mm_storeu_ps(m, _mm_set_ps(0.0f, 0.0f, 0.0f, scale[i].x));
+        _mm_storeu_ps(m + 4, _mm_set_ps(0.0f, 0.0f, scale[i].y, 0.0f));
+        _mm_storeu_ps(m + 8, _mm_set_ps(0.0f, scale[i].z, 0.0f, 0.0f));
+        _mm_storeu_ps(m + 12, _mm_set_ps(1.0f, translation[i].z, translation[i].y, translation[i].x));
+    }
+}
+#endif // SIMULATION_X86
+
+inline void translateScaleKernel(SimdLevel level, const glm::vec3* translation, const glm::vec3* scale, glm::mat4* out,
+                                 size_t begin, size_t end)
+{
+#ifdef SIMULATION_X86
+    if (level >= SimdSSE2)
+    {
+        translateScaleSSE2(translation, scale, out, begin, end);
+        return;
+    }
+#endif
+    translateScaleScalar(translation, scale, out, begin, end);
+}
+
+// Fills `out` (resized to match) with translateScale(translation[i], scale[i])
+inline void buildTranslateScale(const std::vector<glm::vec3>& translation, const std::vector<glm::vec3>& scale,
+                                std::vector<glm::mat4>& out, SimdLevel level, ThreadPool* pool = nullptr, size_t minChunk = 4096)
+{
+    size_t count = std::min(translation.size(), scale.size());
+    out.resize(count);
+    if (!pool)
+    {
+        translateScaleKernel(level, translation.data(), scale.data(), out.data(), 0, count);
+        return;
+    }
+    pool->parallelFor(count, minChunk, [&](size_t begin, size_t end) {
+        translateScaleKernel(level, translation.data(), scale.data(), out.data(), begin, end);
+    });
+}
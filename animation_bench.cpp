@@ -0,0 +1,261 @@
+// Microbenchmarks for the CPU-side geometry and transform code, on Google Benchmark.
+// Needs no OpenGL:
+//
+//     g++ -O2 -pthread animation_bench.cpp -o animation_bench -lbenchmark
+//     ./animation_bench [--benchmark_filter=Orbits] [--benchmark_format=json]
+//
+// Covers sphere generation at the LOD tessellations and above, the orbit update and
+// translate/scale matrix building over 10k to 1M objects, and the mouse-look update.
+// The batch kernels run as scalar, SSE2 and AVX2 on one thread and on the whole pool
+// ("_mt", timed by wall clock); levels the CPU lacks are skipped. Each benchmark also
+// reports heap allocations per iteration ("allocs"), counted by a replaced operator
+// new. Before running, the SIMD kernels are checked against the scalar ones.
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <string>
+
+#include "animation.h"
+#include "geometry.h"
+
+static std::atomic<size_t> allocationCount(0);
+
+// GCC pairs the inlined free() below with the new-expressions it was called for
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { operator delete(p); }
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+void operator delete[](void* p, size_t) noexcept { operator delete(p); }
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+// Allocations made from construction until report(), averaged over the iterations
+struct AllocationScope
+{
+    size_t start = allocationCount.load(std::memory_order_relaxed);
+
+    void report(benchmark::State& state) const
+    {
+        double allocations = (double)(allocationCount.load(std::memory_order_relaxed) - start);
+        state.counters["allocs"] = benchmark::Counter(allocations, benchmark::Counter::kAvgIterations);
+    }
+};
+
+ThreadPool& benchPool()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+// Skips levels the CPU cannot run; returns the pool for threaded variants, or null
+bool prepareVariant(benchmark::State& state, SimdLevel level, bool threaded, ThreadPool*& pool)
+{
+    pool = threaded ? &benchPool() : nullptr;
+    if (level > detectSimdLevel())
+    {
+        state.SkipWithError((std::string(simdLevelName(level)) + " is not supported here").c_str());
+        return false;
+    }
+    if (pool)
+        state.SetLabel(std::to_string(pool->threadCount()) + " threads");
+    return true;
+}
+
+void fillOrbits(OrbitArrays& o, size_t count)
+{
+    std::mt19937 rng(371);
+    std::uniform_real_distribution<float> radius(2.0f, 30.0f);
+    std::uniform_real_distribution<float> speed(0.1f, 2.0f);
+    std::uniform_real_distribution<float> height(-1.0f, 3.0f);
+    for (size_t i = 0; i < count; ++i)
+    {
+        o.radius.push_back(radius(rng));
+        o.speed.push_back(speed(rng));
+        o.height.push_back(height(rng));
+    }
+    o.x.assign(count, 0.0f);
+    o.y.assign(count, 0.0f);
+    o.z.assign(count, 0.0f);
+}
+
+void fillTransforms(std::vector<glm::vec3>& translation, std::vector<glm::vec3>& scale, size_t count)
+{
+    std::mt19937 rng(371);
+    std::uniform_real_distribution<float> position(-50.0f, 50.0f);
+    std::uniform_real_distribution<float> size(0.05f, 4.0f);
+    translation.resize(count);
+    scale.resize(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        translation[i] = glm::vec3(position(rng), position(rng), position(rng));
+        scale[i] = glm::vec3(size(rng), size(rng), size(rng));
+    }
+}
+
+// Fresh buffers each iteration, as buildSphereLodChain() does
+void BM_GenerateSphere(benchmark::State& state)
+{
+    int sectors = (int)state.range(0), stacks = (int)state.range(1);
+    size_t vertexCount = 0;
+    AllocationScope allocations;
+    for (auto _ : state)
+    {
+        std::vector<float> vertices;
+        std::vector<unsigned int> indices;
+        generateSphere(1.0f, sectors, stacks, vertices, indices);
+        benchmark::DoNotOptimize(vertices.data());
+        benchmark::DoNotOptimize(indices.data());
+        vertexCount = vertices.size() / 8;
+    }
+    allocations.report(state);
+    state.counters["vertices"] = (double)vertexCount;
+    state.SetItemsProcessed(state.iterations() * vertexCount);
+}
+BENCHMARK(BM_GenerateSphere)->Args({ 10, 8 })->Args({ 16, 16 })->Args({ 32, 32 })->Args({ 64, 64 })->Args({ 128, 128 })->Args({ 256, 256 });
+
+void BM_Orbits(benchmark::State& state, SimdLevel level, bool threaded)
+{
+    ThreadPool* pool;
+    if (!prepareVariant(state, level, threaded, pool))
+        return;
+    OrbitArrays orbits;
+    fillOrbits(orbits, (size_t)state.range(0));
+    float time = 0.0f;
+    AllocationScope allocations;
+    for (auto _ : state)
+    {
+        updateOrbits(orbits, time, level, pool);
+        benchmark::DoNotOptimize(orbits.x.data());
+        benchmark::ClobberMemory();
+        time += 1.0f / 60.0f;
+    }
+    allocations.report(state);
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_CAPTURE(BM_Orbits, scalar, SimdScalar, false)->RangeMultiplier(10)->Range(10000, 1000000);
+BENCHMARK_CAPTURE(BM_Orbits, sse2, SimdSSE2, false)->RangeMultiplier(10)->Range(10000, 1000000);
+BENCHMARK_CAPTURE(BM_Orbits, avx2, SimdAVX2, false)->RangeMultiplier(10)->Range(10000, 1000000);
+BENCHMARK_CAPTURE(BM_Orbits, scalar_mt, SimdScalar, true)->RangeMultiplier(10)->Range(10000, 1000000)->UseRealTime();
+BENCHMARK_CAPTURE(BM_Orbits, sse2_mt, SimdSSE2, true)->RangeMultiplier(10)->Range(10000, 1000000)->UseRealTime();
+BENCHMARK_CAPTURE(BM_Orbits, avx2_mt, SimdAVX2, true)->RangeMultiplier(10)->Range(10000, 1000000)->UseRealTime();
+
+void BM_TranslateScale(benchmark::State& state, SimdLevel level, bool threaded)
+{
+    ThreadPool* pool;
+    if (!prepareVariant(state, level, threaded, pool))
+        return;
+    std::vector<glm::vec3> translation, scale;
+    std::vector<glm::mat4> matrices((size_t)state.range(0));
+    fillTransforms(translation, scale, (size_t)state.range(0));
+    AllocationScope allocations;
+    for (auto _ : state)
+    {
+        buildTranslateScale(translation, scale, matrices, level, pool);
+        benchmark::DoNotOptimize(matrices.data());
+        benchmark::ClobberMemory();
+    }
+    allocations.report(state);
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * state.range(0) * (int64_t)sizeof(glm::mat4));
+}
+BENCHMARK_CAPTURE(BM_TranslateScale, scalar, SimdScalar, false)->RangeMultiplier(10)->Range(10000, 1000000);
+BENCHMARK_CAPTURE(BM_TranslateScale, sse2, SimdSSE2, false)->RangeMultiplier(10)->Range(10000, 1000000);
+BENCHMARK_CAPTURE(BM_TranslateScale, scalar_mt, SimdScalar, true)->RangeMultiplier(10)->Range(10000, 1000000)->UseRealTime();
+BENCHMARK_CAPTURE(BM_TranslateScale, sse2_mt, SimdSSE2, true)->RangeMultiplier(10)->Range(10000, 1000000)->UseRealTime();
+
+// A stream of cursor deltas through the mouse_callback math, one event after another
+void BM_MouseLook(benchmark::State& state)
+{
+    size_t count = (size_t)state.range(0);
+    std::mt19937 rng(371);
+    std::uniform_real_distribution<float> delta(-20.0f, 20.0f);
+    std::vector<glm::vec2> deltas(count);
+    for (glm::vec2& d : deltas)
+        d = glm::vec2(delta(rng), delta(rng));
+    float yaw = -90.0f, pitch = 0.0f;
+    glm::vec3 front(0.0f);
+    AllocationScope allocations;
+    for (auto _ : state)
+    {
+        for (const glm::vec2& d : deltas)
+        {
+            applyMouseLook(yaw, pitch, d.x, d.y);
+            front = lookDirection(yaw, pitch);
+        }
+        benchmark::DoNotOptimize(front);
+    }
+    allocations.report(state);
+    state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_MouseLook)->RangeMultiplier(10)->Range(10000, 1000000);
+
+// The SIMD kernels must match the scalar ones before their timings mean anything
+bool checkKernels()
+{
+    bool ok = true;
+    const size_t count = 10007;    // not a multiple of the vector width
+    OrbitArrays reference;
+    fillOrbits(reference, count);
+    orbitsScalar(reference, 0, count, 123.4f);
+    for (SimdLevel level : { SimdSSE2, SimdAVX2 })
+    {
+        if (level > detectSimdLevel())
+            continue;
+        OrbitArrays orbits;
+        fillOrbits(orbits, count);
+        orbitsKernel(level, orbits, 0, count, 123.4f);
+        float maxError = 0.0f;
+        for (size_t i = 0; i < count; ++i)
+        {
+            maxError = std::max(maxError, std::fabs(orbits.x[i] - reference.x[i]));
+            maxError = std::max(maxError, std::fabs(orbits.z[i] - reference.z[i]));
+        }
+        bool passed = maxError < 1e-3f;
+        printf("orbits %s: max error %g %s\n", simdLevelName(level), maxError, passed ? "ok" : "MISMATCH");
+        ok = ok && passed;
+    }
+
+    std::vector<glm::vec3> translation, scale;
+    std::vector<glm::mat4> expected, matrices;
+    fillTransforms(translation, scale, count);
+    buildTranslateScale(translation, scale, expected, SimdScalar);
+    if (detectSimdLevel() >= SimdSSE2)
+    {
+        buildTranslateScale(translation, scale, matrices, SimdSSE2);
+        bool same = std::equal(expected.begin(), expected.end(), matrices.begin());
+        printf("translateScale sse2: %s\n", same ? "ok" : "MISMATCH");
+        ok = ok && same;
+    }
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    if (!checkKernels())
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
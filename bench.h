@@ -0,0 +1,237 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Per-frame timings for --bench runs. CPU time covers building and submitting
+// the frame, GPU time comes from GL_TIME_ELAPSED queries and frame time is the
+// wall clock between consecutive frame starts.
+struct FrameSample
+{
+    double cpuMs = 0.0;
+    double gpuMs = 0.0;
+    double frameMs = 0.0;
+    bool excluded = false;    // left out of the timings, e.g. stalled on a frame readback
+};
+
+struct TimingSummary
+{
+    double mean = 0.0;
+    double p50 = 0.0;
+    double p95 = 0.0;
+    double p99 = 0.0;
+    double max = 0.0;
+};
+
+inline TimingSummary summarizeTimings(std::vector<double> values)
+{
+    TimingSummary summary;
+    if (values.empty())
+        return summary;
+
+    std::sort(values.begin(), values.end());
+    double total = 0.0;
+    for (double v : values)
+        total += v;
+    summary.mean = total / values.size();
+
+    // Nearest-rank percentiles
+    auto percentile = [&](double p) {
+        size_t rank = (size_t)std::ceil(p / 100.0 * values.size());
+        return values[std::min(values.size() - 1, rank > 0 ? rank - 1 : 0)];
+    };
+    summary.p50 = percentile(50.0);
+    summary.p95 = percentile(95.0);
+    summary.p99 = percentile(99.0);
+    summary.max = values.back();
+    return summary;
+}
+
+// GPU timer queries are read back a few frames late so the CPU never waits on them
+const int kBenchQueryLatency = 4;
+
+struct BenchRecorder
+{
+    typedef std::chrono::steady_clock Clock;
+
+    int warmupFrames = 0;
+    std::vector<FrameSample> samples;
+
+    // Named per-frame counters (objects culled, draw calls, ...) reported next to the timings
+    std::vector<std::string> counterNames;
+    std::vector<std::vector<double>> counterValues;
+
+    GLuint queries[kBenchQueryLatency] = {};
+    int queryFrame[kBenchQueryLatency] = {};
+    int frameIndex = 0;
+    Clock::time_point frameStart;
+    Clock::time_point lastFrameStart;
+
+    void init(int frameCount, int warmup)
+    {
+        warmupFrames = warmup;
+        samples.assign(frameCount, FrameSample());
+        glGenQueries(kBenchQueryLatency, queries);
+        for (int i = 0; i < kBenchQueryLatency; ++i)
+            queryFrame[i] = -1;
+        lastFrameStart = Clock::now();
+    }
+
+    void beginFrame()
+    {
+        frameStart = Clock::now();
+        if (frameIndex > 0)
+            samples[frameIndex - 1].frameMs = std::chrono::duration<double, std::milli>(frameStart - lastFrameStart).count();
+        lastFrameStart = frameStart;
+
+        int slot = frameIndex % kBenchQueryLatency;
+        if (queryFrame[slot] >= 0)
+            collectQuery(slot);
+        glBeginQuery(GL_TIME_ELAPSED, queries[slot]);
+        queryFrame[slot] = frameIndex;
+    }
+
+    void endFrame()
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        glFlush();
+        samples[frameIndex].cpuMs = std::chrono::duration<double, std::milli>(Clock::now() - frameStart).count();
+        ++frameIndex;
+    }
+
+    // Waits for the GPU to drain and records the last frame and outstanding queries
+    void finish()
+    {
+        glFinish();
+        if (frameIndex > 0)
+            samples[frameIndex - 1].frameMs = std::chrono::duration<double, std::milli>(Clock::now() - lastFrameStart).count();
+        for (int i = 0; i < kBenchQueryLatency; ++i)
+        {
+            if (queryFrame[i] >= 0)
+                collectQuery(i);
+        }
+        glDeleteQueries(kBenchQueryLatency, queries);
+        samples.resize(frameIndex);
+        for (std::vector<double>& values : counterValues)
+            values.resize(frameIndex);
+    }
+
+    // Records a counter for the frame between beginFrame() and endFrame()
+    void setCounter(const std::string& name, double value)
+    {
+        size_t index = std::find(counterNames.begin(), counterNames.end(), name) - counterNames.begin();
+        if (index == counterNames.size())
+        {
+            counterNames.push_back(name);
+            counterValues.push_back(std::vector<double>(samples.size(), 0.0));
+        }
+        counterValues[index][frameIndex] = value;
+    }
+
+    void collectQuery(int slot)
+    {
+        GLuint64 elapsedNs = 0;
+        glGetQueryObjectui64v(queries[slot], GL_QUERY_RESULT, &elapsedNs);
+        samples[queryFrame[slot]].gpuMs = elapsedNs / 1.0e6;
+        queryFrame[slot] = -1;
+    }
+
+    // Leaves the frame between beginFrame() and endFrame() out of the timing statistics
+    void excludeFrame() { samples[frameIndex].excluded = true; }
+
+    std::vector<double> column(double FrameSample::*field) const
+    {
+        std::vector<double> values;
+        for (size_t i = warmupFrames; i < samples.size(); ++i)
+        {
+            if (!samples[i].excluded)
+                values.push_back(samples[i].*field);
+        }
+        return values;
+    }
+
+    bool writeCsv(const std::string& path) const
+    {
+        std::ofstream out(path);
+        if (!out)
+            return false;
+        out << "frame,cpu_ms,gpu_ms,frame_ms,warmup,excluded";
+        for (const std::string& name : counterNames)
+            out << ',' << name;
+        out << '\n';
+        for (size_t i = 0; i < samples.size(); ++i)
+        {
+            const FrameSample& s = samples[i];
+            out << i << ',' << s.cpuMs << ',' << s.gpuMs << ',' << s.frameMs << ',' << ((int)i < warmupFrames ? 1 : 0) << ','
+                << (s.excluded ? 1 : 0);
+            for (const std::vector<double>& values : counterValues)
+                out << ',' << values[i];
+            out << '\n';
+        }
+        return true;
+    }
+
+    bool writeJson(const std::string& path, float timestep) const
+    {
+        std::ofstream out(path);
+        if (!out)
+            return false;
+
+        auto writeSummary = [&](const char* name, const TimingSummary& t, bool last) {
+            out << "  \"" << name << "\": { \"mean\": " << t.mean << ", \"p50\": " << t.p50 << ", \"p95\": " << t.p95
+                << ", \"p99\": " << t.p99 << ", \"max\": " << t.max << " }" << (last ? "\n" : ",\n");
+        };
+
+        std::vector<double> frameTimes = column(&FrameSample::frameMs);
+        TimingSummary frame = summarizeTimings(frameTimes);
+        int measured = (int)frameTimes.size();
+        int counted = std::max(0, (int)samples.size() - warmupFrames);
+        double totalMs = 0.0;
+        for (double v : frameTimes)
+            totalMs += v;
+
+        out << "{\n";
+        out << "  \"frames\": " << measured << ",\n";
+        out << "  \"warmup_frames\": " << warmupFrames << ",\n";
+        out << "  \"timestep\": " << timestep << ",\n";
+        out << "  \"fps\": " << (totalMs > 0.0 ? measured * 1000.0 / totalMs : 0.0) << ",\n";
+        writeSummary("cpu_ms", summarizeTimings(column(&FrameSample::cpuMs)), false);
+        writeSummary("gpu_ms", summarizeTimings(column(&FrameSample::gpuMs)), false);
+        writeSummary("frame_ms", frame, false);
+        // Counters are reported as their mean over every frame after the warmup
+        out << "  \"counters\": {";
+        for (size_t c = 0; c < counterNames.size(); ++c)
+        {
+            double total = 0.0;
+            for (size_t i = warmupFrames; i < counterValues[c].size(); ++i)
+                total += counterValues[c][i];
+            out << (c ? ", " : " ") << '"' << counterNames[c] << "\": " << (counted > 0 ? total / counted : 0.0);
+        }
+        out << " }\n";
+        out << "}\n";
+        return true;
+    }
+
+    void printSummary() const
+    {
+        TimingSummary cpu = summarizeTimings(column(&FrameSample::cpuMs));
+        TimingSummary gpu = summarizeTimings(column(&FrameSample::gpuMs));
+        TimingSummary frame = summarizeTimings(column(&FrameSample::frameMs));
+        std::cout << "bench: " << column(&FrameSample::frameMs).size() << " frames, "
+                  << (frame.mean > 0.0 ? 1000.0 / frame.mean : 0.0) << " fps\n"
+                  << "  cpu   p50 " << cpu.p50 << " ms  p95 " << cpu.p95 << " ms  p99 " << cpu.p99 << " ms\n"
+                  << "  gpu   p50 " << gpu.p50 << " ms  p95 " << gpu.p95 << " ms  p99 " << gpu.p99 << " ms\n"
+                  << "  frame p50 " << frame.p50 << " ms  p95 " << frame.p95 << " ms  p99 " << frame.p99 << " ms\n";
+        for (size_t c = 0; c < counterNames.size(); ++c)
+        {
+            TimingSummary counter = summarizeTimings(std::vector<double>(counterValues[c].begin() + std::min<size_t>(warmupFrames, counterValues[c].size()), counterValues[c].end()));
+            std::cout << "  " << counterNames[c] << " mean " << counter.mean << " max " << counter.max << "\n";
+        }
+    }
+};
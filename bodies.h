@@ -0,0 +1,399 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <stb/stb_image.h>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "profiler.h"
+#include "shader.h"
+#include "simulation.h"
+#include "culling.h"
+#include "geometry.h"
+#include "occlusion.h"
+#include "streambuffer.h"
+
+// Instanced rendering of large orbiting populations (asteroid belts, particles).
+// Every body is one instance of a shared sphere mesh. The visible bodies' position,
+// scale, colour and texture layer are streamed each frame from the OrbitalSimulation,
+// grouped by sphere LOD, and each LOD is drawn with one glDrawElementsInstanced call.
+
+const char* const bodyVertexShaderSource = R"(
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec2 aNormal;
+layout(location = 2) in vec2 aTexCoord;
+layout(location = 3) in vec4 aPositionScale;
+layout(location = 4) in vec4 aColorLayer;
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoord;
+flat out vec4 ColorLayer;
+invariant gl_Position;
+
+void main() {
+    // Bodies are uniformly scaled and unrotated, so the mesh normal is the world normal
+    FragPos = aPositionScale.xyz + aPos * aPositionScale.w;
+    Normal = decodeNormal(aNormal);
+    TexCoord = aTexCoord;
+    ColorLayer = aColorLayer;
+    gl_Position = projectionMatrix * viewMatrix * vec4(FragPos, 1.0);
+})";
+
+const char* const bodyFragmentShaderSource = R"(
+in vec3 FragPos;
+in vec3 Normal;
+in vec2 TexCoord;
+flat in vec4 ColorLayer;
+
+out vec4 FragColor;
+
+uniform sampler2DArray bodyTextures;
+
+void main() {
+    vec3 lighting = computeLighting(FragPos, normalize(Normal), gl_FragCoord.xy);
+
+    // A negative layer means the body is untextured and uses its flat colour
+    vec3 baseColor = ColorLayer.w >= 0.0 ? texture(bodyTextures, vec3(TexCoord, ColorLayer.w)).rgb * ColorLayer.rgb
+                                         : ColorLayer.rgb;
+    FragColor = vec4(lighting * baseColor, 1.0);
+}
+)";
+
+struct OrbitingBody
+{
+    float orbitRadius;
+    float eccentricity;
+    float orbitSpeed;
+    float phase;
+    float height;
+    float size;
+    glm::vec3 color;
+    float textureLayer;
+};
+
+// Per-instance vertex data, attributes 3 and 4
+struct BodyInstance
+{
+    glm::vec4 positionScale;
+    glm::vec4 colorLayer;
+};
+
+struct BodyRenderer
+{
+    ShaderProgram program;
+    GLuint VAO = 0;
+    StreamBuffer instanceStream;    // visible instances, scattered straight into the mapping
+    StreamAllocation instanceAllocation;
+    GLuint textureArray = 0;
+    int instanceCount = 0;
+    int visibleCount = 0;
+    std::vector<float> sizes;
+    float maxSize = 0.0f;
+    std::vector<glm::vec4> colorLayers;
+
+    // Sphere LODs in the shared index buffer and the visible instances drawn with each
+    std::vector<MeshLod> lods;
+    std::vector<float> minPixelRadius;
+    std::vector<int> lodCounts;
+    std::vector<unsigned char> bodyLods;    // per body, kept for hysteresis
+
+    // Per-chunk compaction scratch, then the visible instances grouped by LOD
+    std::vector<BodyInstance> packed;
+    std::vector<unsigned char> packedLods;
+    std::vector<int> chunkCounts;           // chunks x LODs
+    std::vector<size_t> chunkVisible;
+    std::vector<size_t> chunkOccluded;
+};
+
+// Random belt of small bodies between the central sphere and the walls
+inline std::vector<OrbitingBody> generateAsteroidBelt(int count, int textureLayers, unsigned int seed = 371)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> radius(6.0f, 13.0f);
+    std::uniform_real_distribution<float> eccentricity(0.0f, 0.1f);
+    std::uniform_real_distribution<float> phase(0.0f, 6.2831853f);
+    std::uniform_real_distribution<float> height(-0.4f, 0.4f);
+    std::uniform_real_distribution<float> size(0.04f, 0.14f);
+    std::uniform_real_distribution<float> tint(0.7f, 1.0f);
+    std::uniform_int_distribution<int> layer(0, std::max(0, textureLayers - 1));
+
+    std::vector<OrbitingBody> bodies;
+    bodies.reserve(count);
+    for (int i = 0; i < count; ++i)
+    {
+        OrbitingBody body;
+        body.orbitRadius = radius(rng);
+        body.eccentricity = eccentricity(rng);
+        // Inner bodies orbit faster, following Kepler's third law for the simulation's central GM
+        body.orbitSpeed = 6.0f / (body.orbitRadius * std::sqrt(body.orbitRadius));
+        body.phase = phase(rng);
+        body.height = 1.0f + height(rng);
+        body.size = size(rng);
+        float t = tint(rng);
+        body.color = glm::vec3(t, t * 0.95f, t * 0.9f);
+        body.textureLayer = textureLayers > 0 ? (float)layer(rng) : -1.0f;
+        bodies.push_back(body);
+    }
+    return bodies;
+}
+
+inline void addBodiesToSimulation(OrbitalSimulation& simulation, const std::vector<OrbitingBody>& bodies)
+{
+    simulation.reserve(simulation.bodies.size() + bodies.size());
+    for (const OrbitingBody& body : bodies)
+    {
+        // Mass scales with volume; the whole belt stays far lighter than the central body
+        float mass = 2e-4f * body.size * body.size * body.size;
+        simulation.addBody(body.orbitRadius, body.eccentricity, body.orbitSpeed, body.phase, body.height, mass);
+    }
+}
+
+// Loads images into the layers of a GL_TEXTURE_2D_ARRAY, resampled to a common size.
+// Layers whose file is missing are left white so the body colour shows through.
+inline GLuint loadTextureArray(const std::vector<const char*>& filenames, int size)
+{
+    std::vector<unsigned char> layers(filenames.size() * size * size * 3, 255);
+    for (size_t layer = 0; layer < filenames.size(); ++layer)
+    {
+        int width, height, nrChannels;
+        unsigned char* data = stbi_load(filenames[layer], &width, &height, &nrChannels, 3);
+        if (!data)
+        {
+            std::cerr << "Failed to load texture: " << filenames[layer] << std::endl;
+            continue;
+        }
+
+        // Bilinear resample into the layer
+        unsigned char* dst = &layers[layer * size * size * 3];
+        for (int y = 0; y < size; ++y)
+        {
+            float sy = (y + 0.5f) * height / size - 0.5f;
+            int y0 = std::max(0, std::min(height - 1, (int)std::floor(sy)));
+            int y1 = std::min(height - 1, y0 + 1);
+            float fy = std::max(0.0f, sy - y0);
+            for (int x = 0; x < size; ++x)
+            {
+                float sx = (x + 0.5f) * width / size - 0.5f;
+                int x0 = std::max(0, std::min(width - 1, (int)std::floor(sx)));
+                int x1 = std::min(width - 1, x0 + 1);
+                float fx = std::max(0.0f, sx - x0);
+                for (int c = 0; c < 3; ++c)
+                {
+                    float top = data[(y0 * width + x0) * 3 + c] * (1.0f - fx) + data[(y0 * width + x1) * 3 + c] * fx;
+                    float bottom = data[(y1 * width + x0) * 3 + c] * (1.0f - fx) + data[(y1 * width + x1) * 3 + c] * fx;
+                    dst[(y * size + x) * 3 + c] = (unsigned char)(top * (1.0f - fy) + bottom * fy + 0.5f);
+                }
+            }
+        }
+        stbi_image_free(data);
+    }
+
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB8, size, size, (GLsizei)filenames.size(), 0, GL_RGB, GL_UNSIGNED_BYTE, layers.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    return texture;
+}
+
+// Builds the instanced VAO over the sphere LOD chain's existing VBO/EBO (PackedVertex)
+inline BodyRenderer createBodyRenderer(const std::vector<OrbitingBody>& bodies, const SphereLodChain& sphereLods,
+                                       GLuint sphereVBO, GLuint sphereEBO, GLuint textureArray, const char* shaderHeader,
+                                       ProgramCache* programCache = nullptr)
+{
+    BodyRenderer renderer;
+    renderer.program = createShaderProgram(bodyVertexShaderSource, bodyFragmentShaderSource, shaderHeader, programCache);
+    renderer.instanceCount = (int)bodies.size();
+    renderer.textureArray = textureArray;
+    renderer.lods = sphereLods.lods;
+    renderer.minPixelRadius = sphereLods.minPixelRadius;
+    renderer.lodCounts.assign(sphereLods.lods.size(), 0);
+    renderer.bodyLods.assign(bodies.size(), 0xFF);
+    renderer.packed.resize(bodies.size());
+    renderer.packedLods.resize(bodies.size());
+    renderer.sizes.resize(bodies.size());
+    renderer.colorLayers.resize(bodies.size());
+    for (size_t i = 0; i < bodies.size(); ++i)
+    {
+        renderer.sizes[i] = bodies[i].size;
+        renderer.maxSize = std::max(renderer.maxSize, bodies[i].size);
+        renderer.colorLayers[i] = glm::vec4(bodies[i].color, bodies[i].textureLayer);
+    }
+
+    glUseProgram(renderer.program.id);
+    glUniform1i(renderer.program.location("bodyTextures"), 1);
+    glUseProgram(0);
+
+    glGenVertexArrays(1, &renderer.VAO);
+    glBindVertexArray(renderer.VAO);
+
+    glBindBuffer(GL_ARRAY_BUFFER, sphereVBO);
+    setPackedVertexAttributes();
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sphereEBO);
+
+    // Rewritten every frame with the visible bodies only
+    renderer.instanceStream.create(std::max<size_t>(1, bodies.size()) * sizeof(BodyInstance));
+    glBindBuffer(GL_ARRAY_BUFFER, renderer.instanceStream.buffer());
+    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(BodyInstance), (void*)offsetof(BodyInstance, positionScale));
+    glEnableVertexAttribArray(3);
+    glVertexAttribDivisor(3, 1);
+    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(BodyInstance), (void*)offsetof(BodyInstance, colorLayer));
+    glEnableVertexAttribArray(4);
+    glVertexAttribDivisor(4, 1);
+
+    glBindVertexArray(0);
+    return renderer;
+}
+
+// Interleaves the simulation's SoA positions with body sizes, dropping bodies outside
+// the frustum and picking each visible body's LOD from its projected radius. Each chunk
+// compacts in place in parallel and counts its bodies per LOD; the chunks are then
+// scattered so every LOD's instances are contiguous, directly into the instance stream.
+// With an occlusion culler, bodies in grid cells it found hidden are dropped as well.
+inline void updateBodyInstances(BodyRenderer& renderer, const BodyArrays& state, const Frustum& frustum,
+                                const glm::vec3& viewPos, float pixelScale, ThreadPool* pool, CullStats& stats,
+                                const OcclusionCuller* occlusion = nullptr)
+{
+    if (occlusion && !occlusion->anyCellHidden())
+        occlusion = nullptr;
+    size_t count = renderer.sizes.size();
+    size_t lodCount = renderer.lods.size();
+    size_t chunks = pool ? (size_t)pool->threadCount() * 4 : 1;
+    chunks = std::max<size_t>(1, std::min(chunks, count / 4096));
+    renderer.chunkCounts.assign(chunks * lodCount, 0);
+    renderer.chunkVisible.assign(chunks, 0);
+    renderer.chunkOccluded.assign(chunks, 0);
+
+    auto pack = [&](size_t chunkBegin, size_t chunkEnd) {
+        ProfileZone zone("bodies.cull");
+        for (size_t chunk = chunkBegin; chunk < chunkEnd; ++chunk)
+        {
+            size_t begin = count * chunk / chunks;
+            size_t end = count * (chunk + 1) / chunks;
+            size_t out = begin;
+            int* lodCounts = &renderer.chunkCounts[chunk * lodCount];
+            for (size_t i = begin; i < end; ++i)
+            {
+                glm::vec3 center(state.x[i], state.y[i], state.z[i]);
+                float size = renderer.sizes[i];
+                if (sphereVisible(frustum, center, size * kSphereRadius))
+                {
+                    if (occlusion && occlusion->cellHidden(center))
+                    {
+                        ++renderer.chunkOccluded[chunk];
+                        continue;
+                    }
+                    float pixels = projectedRadius(size * kSphereRadius, glm::length(center - viewPos), pixelScale);
+                    int lod = selectLod(renderer.minPixelRadius, renderer.bodyLods[i], pixels);
+                    renderer.bodyLods[i] = (unsigned char)lod;
+                    renderer.packed[out].positionScale = glm::vec4(center, size);
+                    renderer.packed[out].colorLayer = renderer.colorLayers[i];
+                    renderer.packedLods[out] = (unsigned char)lod;
+                    ++lodCounts[lod];
+                    ++out;
+                }
+            }
+            renderer.chunkVisible[chunk] = out - begin;
+        }
+    };
+    if (pool && chunks > 1)
+        pool->parallelFor(chunks, 1, pack);
+    else
+        pack(0, chunks);
+
+    // Exclusive prefix over (LOD, chunk) turns the counts into scatter offsets
+    size_t visible = 0;
+    for (size_t lod = 0; lod < lodCount; ++lod)
+    {
+        int lodTotal = 0;
+        for (size_t chunk = 0; chunk < chunks; ++chunk)
+        {
+            int& slot = renderer.chunkCounts[chunk * lodCount + lod];
+            int chunkCount = slot;
+            slot = (int)visible;
+            visible += chunkCount;
+            lodTotal += chunkCount;
+        }
+        renderer.lodCounts[lod] = lodTotal;
+    }
+
+    renderer.instanceAllocation = renderer.instanceStream.allocate(visible * sizeof(BodyInstance));
+    BodyInstance* instances = (BodyInstance*)renderer.instanceAllocation.data;
+    if (!instances)
+        visible = 0;
+
+    auto scatter = [&](size_t chunkBegin, size_t chunkEnd) {
+        ProfileZone zone("bodies.scatter");
+        for (size_t chunk = chunkBegin; chunk < chunkEnd; ++chunk)
+        {
+            size_t begin = count * chunk / chunks;
+            int* offsets = &renderer.chunkCounts[chunk * lodCount];
+            for (size_t i = begin; i < begin + renderer.chunkVisible[chunk]; ++i)
+                instances[offsets[renderer.packedLods[i]]++] = renderer.packed[i];
+        }
+    };
+    if (instances && pool && chunks > 1)
+        pool->parallelFor(chunks, 1, scatter);
+    else if (instances)
+        scatter(0, chunks);
+    renderer.instanceStream.unmap();
+
+    renderer.visibleCount = (int)visible;
+    stats.objectsTested += (int)count;
+    stats.objectsCulled += (int)(count - visible);
+    for (size_t occluded : renderer.chunkOccluded)
+        stats.objectsOccluded += (int)occluded;
+}
+
+// One instanced draw per LOD. Without base-instance support in GL 3.3 the per-instance
+// attributes are re-pointed at each LOD's range of the instance buffer instead. A
+// non-zero programOverride (depth-only or counting variant) draws without textures.
+inline void drawBodies(const BodyRenderer& renderer, GLuint programOverride = 0)
+{
+    if (renderer.visibleCount == 0)
+        return;
+
+    glUseProgram(programOverride ? programOverride : renderer.program.id);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, programOverride ? 0 : renderer.textureArray);
+    glBindVertexArray(renderer.VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, renderer.instanceStream.buffer());
+    size_t firstInstance = 0;
+    for (size_t lod = 0; lod < renderer.lods.size(); ++lod)
+    {
+        int instances = renderer.lodCounts[lod];
+        if (instances == 0)
+            continue;
+        size_t offset = renderer.instanceAllocation.offset + firstInstance * sizeof(BodyInstance);
+        glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(BodyInstance), (void*)(offset + offsetof(BodyInstance, positionScale)));
+        glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(BodyInstance), (void*)(offset + offsetof(BodyInstance, colorLayer)));
+        const MeshLod& mesh = renderer.lods[lod];
+        glDrawElementsInstanced(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_SHORT,
+                                (void*)(mesh.firstIndex * sizeof(unsigned short)), instances);
+        firstInstance += instances;
+    }
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+inline void destroyBodyRenderer(BodyRenderer& renderer)
+{
+    renderer.instanceStream.destroy();
+    glDeleteVertexArrays(1, &renderer.VAO);
+    glDeleteTextures(1, &renderer.textureArray);
+    glDeleteProgram(renderer.program.id);
+    renderer = BodyRenderer();
+}
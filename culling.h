@@ -0,0 +1,269 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// View-frustum culling. Scene objects are wrapped in world-space AABBs and
+// organised in a bounding-volume hierarchy that is refitted every frame and
+// rebuilt when the object set changes or the tree has drifted for a while.
+
+struct AABB
+{
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+// Local bounds of the unit meshes
+const AABB kCubeBounds = { glm::vec3(-0.5f), glm::vec3(0.5f) };
+const AABB kSphereBounds = { glm::vec3(-0.5f), glm::vec3(0.5f) };
+const float kSphereRadius = 0.5f;
+
+inline AABB mergeBounds(const AABB& a, const AABB& b)
+{
+    return { glm::min(a.min, b.min), glm::max(a.max, b.max) };
+}
+
+// World AABB of a transformed local AABB (Arvo's method)
+inline AABB transformBounds(const AABB& bounds, const glm::mat4& m)
+{
+    glm::vec3 center = 0.5f * (bounds.min + bounds.max);
+    glm::vec3 extent = 0.5f * (bounds.max - bounds.min);
+    glm::vec3 worldCenter = glm::vec3(m * glm::vec4(center, 1.0f));
+    glm::vec3 worldExtent;
+    for (int i = 0; i < 3; ++i)
+        worldExtent[i] = std::fabs(m[0][i]) * extent.x + std::fabs(m[1][i]) * extent.y + std::fabs(m[2][i]) * extent.z;
+    return { worldCenter - worldExtent, worldCenter + worldExtent };
+}
+
+struct Frustum
+{
+    // Planes as (normal, d) with normals pointing inwards: dot(n, p) + d >= 0 inside
+    glm::vec4 planes[6];
+};
+
+// Gribb-Hartmann plane extraction from a (column-major) view-projection matrix
+inline Frustum extractFrustum(const glm::mat4& m)
+{
+    glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+    Frustum frustum;
+    frustum.planes[0] = row3 + row0; // left
+    frustum.planes[1] = row3 - row0; // right
+    frustum.planes[2] = row3 + row1; // bottom
+    frustum.planes[3] = row3 - row1; // top
+    frustum.planes[4] = row3 + row2; // near
+    frustum.planes[5] = row3 - row2; // far
+    for (glm::vec4& plane : frustum.planes)
+        plane = plane / glm::length(glm::vec3(plane));
+    return frustum;
+}
+
+enum CullResult
+{
+    CullOutside,
+    CullIntersect,
+    CullInside
+};
+
+inline CullResult testBounds(const Frustum& frustum, const AABB& bounds)
+{
+    CullResult result = CullInside;
+    for (const glm::vec4& plane : frustum.planes)
+    {
+        glm::vec3 normal(plane);
+        // Corner furthest along the plane normal, and the one opposite it
+        glm::vec3 positive(normal.x >= 0.0f ? bounds.max.x : bounds.min.x,
+                           normal.y >= 0.0f ? bounds.max.y : bounds.min.y,
+                           normal.z >= 0.0f ? bounds.max.z : bounds.min.z);
+        if (glm::dot(normal, positive) + plane.w < 0.0f)
+            return CullOutside;
+        glm::vec3 negative(normal.x >= 0.0f ? bounds.min.x : bounds.max.x,
+                           normal.y >= 0.0f ? bounds.min.y : bounds.max.y,
+                           normal.z >= 0.0f ? bounds.min.z : bounds.max.z);
+        if (glm::dot(normal, negative) + plane.w < 0.0f)
+            result = CullIntersect;
+    }
+    return result;
+}
+
+inline bool sphereVisible(const Frustum& frustum, const glm::vec3& center, float radius)
+{
+    for (const glm::vec4& plane : frustum.planes)
+    {
+        if (plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w < -radius)
+            return false;
+    }
+    return true;
+}
+
+struct CullStats
+{
+    int objectsTested = 0;
+    int objectsCulled = 0;      // by the frustum or by occlusion
+    int objectsOccluded = 0;    // of those, hidden behind other geometry
+    int nodesTested = 0;
+};
+
+// Binary BVH over object AABBs. Leaves hold a contiguous range of `objects`.
+struct BVH
+{
+    struct Node
+    {
+        AABB bounds;
+        int left = -1;    // children are left and left + 1
+        int first = 0;
+        int count = 0;
+    };
+
+    static const int kLeafSize = 2;
+    static const int kRebuildInterval = 120;
+
+    std::vector<Node> nodes;
+    std::vector<int> objects;
+    int framesSinceBuild = 0;
+
+    void build(const std::vector<AABB>& bounds)
+    {
+        nodes.clear();
+        objects.resize(bounds.size());
+        for (size_t i = 0; i < bounds.size(); ++i)
+            objects[i] = (int)i;
+        framesSinceBuild = 0;
+        if (bounds.empty())
+            return;
+        nodes.reserve(bounds.size() * 2);
+        nodes.push_back(Node());
+        buildNode(bounds, 0, 0, (int)bounds.size());
+    }
+
+    void buildNode(const std::vector<AABB>& bounds, int nodeIndex, int first, int count)
+    {
+        AABB box = bounds[objects[first]];
+        AABB centroids = { centroid(box), centroid(box) };
+        for (int i = first + 1; i < first + count; ++i)
+        {
+            box = mergeBounds(box, bounds[objects[i]]);
+            glm::vec3 c = centroid(bounds[objects[i]]);
+            centroids.min = glm::min(centroids.min, c);
+            centroids.max = glm::max(centroids.max, c);
+        }
+        nodes[nodeIndex].bounds = box;
+        nodes[nodeIndex].first = first;
+        nodes[nodeIndex].count = count;
+        if (count <= kLeafSize)
+            return;
+
+        // Median split along the axis with the widest centroid spread
+        glm::vec3 spread = centroids.max - centroids.min;
+        int axis = spread.x > spread.y ? (spread.x > spread.z ? 0 : 2) : (spread.y > spread.z ? 1 : 2);
+        int middle = first + count / 2;
+        std::nth_element(objects.begin() + first, objects.begin() + middle, objects.begin() + first + count,
+                         [&](int a, int b) { return centroid(bounds[a])[axis] < centroid(bounds[b])[axis]; });
+
+        int left = (int)nodes.size();
+        nodes.push_back(Node());
+        nodes.push_back(Node());
+        nodes[nodeIndex].left = left;
+        nodes[nodeIndex].count = 0;
+        buildNode(bounds, left, first, middle - first);
+        buildNode(bounds, left + 1, middle, first + count - middle);
+    }
+
+    // Recomputes node bounds bottom-up for moved objects; children always follow their parent
+    void refit(const std::vector<AABB>& bounds)
+    {
+        for (int i = (int)nodes.size() - 1; i >= 0; --i)
+        {
+            Node& node = nodes[i];
+            if (node.left < 0)
+            {
+                node.bounds = bounds[objects[node.first]];
+                for (int k = node.first + 1; k < node.first + node.count; ++k)
+                    node.bounds = mergeBounds(node.bounds, bounds[objects[k]]);
+            }
+            else
+            {
+                node.bounds = mergeBounds(nodes[node.left].bounds, nodes[node.left + 1].bounds);
+            }
+        }
+    }
+
+    // Refits, or rebuilds when the object count changed or refits have degraded the tree
+    void update(const std::vector<AABB>& bounds)
+    {
+        if (objects.size() != bounds.size() || ++framesSinceBuild >= kRebuildInterval)
+            build(bounds);
+        else
+            refit(bounds);
+    }
+
+    // Appends visible object indices. Subtrees fully inside the frustum are accepted
+    // without further tests, leaves straddling a plane test their objects one by one.
+    void cull(const Frustum& frustum, const std::vector<AABB>& bounds, std::vector<int>& visible, CullStats& stats) const
+    {
+        stats.objectsTested += (int)objects.size();
+        if (nodes.empty())
+            return;
+        int stack[64];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0)
+        {
+            const Node& node = nodes[stack[--top]];
+            ++stats.nodesTested;
+            CullResult result = testBounds(frustum, node.bounds);
+            if (result == CullOutside)
+            {
+                stats.objectsCulled += subtreeObjectCount(node);
+                continue;
+            }
+            if (result == CullInside)
+            {
+                appendSubtree(node, visible);
+                continue;
+            }
+            if (node.left < 0)
+            {
+                for (int k = node.first; k < node.first + node.count; ++k)
+                {
+                    if (node.count == 1 || testBounds(frustum, bounds[objects[k]]) != CullOutside)
+                        visible.push_back(objects[k]);
+                    else
+                        ++stats.objectsCulled;
+                }
+                continue;
+            }
+            stack[top++] = node.left;
+            stack[top++] = node.left + 1;
+        }
+    }
+
+    int subtreeObjectCount(const Node& node) const
+    {
+        if (node.left < 0)
+            return node.count;
+        return subtreeObjectCount(nodes[node.left]) + subtreeObjectCount(nodes[node.left + 1]);
+    }
+
+    void appendSubtree(const Node& node, std::vector<int>& visible) const
+    {
+        if (node.left < 0)
+        {
+            for (int k = node.first; k < node.first + node.count; ++k)
+                visible.push_back(objects[k]);
+            return;
+        }
+        appendSubtree(nodes[node.left], visible);
+        appendSubtree(nodes[node.left + 1], visible);
+    }
+
+    static glm::vec3 centroid(const AABB& box)
+    {
+        return 0.5f * (box.min + box.max);
+    }
+};
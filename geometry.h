@@ -0,0 +1,280 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "mesh.h"
+
+// Mesh generation shared by the renderer. Vertices are 8 floats:
+// position (3), normal (3), texture coordinates (2).
+
+const float kPi = 3.14159265359f;
+
+// Sphere generation function
+inline void generateSphere(float radius, int sectors, int stacks, std::vector<float>& vertices, std::vector<unsigned int>& indices)
+{
+    vertices.clear();
+    indices.clear();
+    vertices.reserve((stacks + 1) * (sectors + 1) * 8);
+    indices.reserve(stacks * sectors * 6);
+
+    for (int i = 0; i <= stacks; ++i)
+    {
+        float v = i / (float)stacks;
+        float phi = v * kPi;
+
+        for (int j = 0; j <= sectors; ++j)
+        {
+            float u = j / (float)sectors;
+            float theta = u * 2.0f * kPi;
+
+            float x = cos(theta) * sin(phi);
+            float y = cos(phi);
+            float z = sin(theta) * sin(phi);
+
+            // Position
+            vertices.push_back(x * radius);
+            vertices.push_back(y * radius);
+            vertices.push_back(z * radius);
+
+            // Normal (same as position for a unit sphere)
+            vertices.push_back(x);
+            vertices.push_back(y);
+            vertices.push_back(z);
+
+            // Texture coordinates
+            vertices.push_back(u);
+            vertices.push_back(v);
+        }
+    }
+
+    for (int i = 0; i < stacks; ++i)
+    {
+        for (int j = 0; j < sectors; ++j)
+        {
+            int k1 = i * (sectors + 1) + j;
+            int k2 = k1 + sectors + 1;
+
+            indices.push_back(k1);
+            indices.push_back(k2);
+            indices.push_back(k1 + 1);
+
+            indices.push_back(k1 + 1);
+            indices.push_back(k2);
+            indices.push_back(k2 + 1);
+        }
+    }
+}
+
+// Icosahedron, optionally subdivided, with the same UV mapping as generateSphere
+inline void generateIcosphere(float radius, int subdivisions, std::vector<float>& vertices, std::vector<unsigned int>& indices)
+{
+    const float t = (1.0f + std::sqrt(5.0f)) * 0.5f;
+    std::vector<float> points = {
+        -1, t, 0,  1, t, 0,  -1, -t, 0,  1, -t, 0,
+        0, -1, t,  0, 1, t,  0, -1, -t,  0, 1, -t,
+        t, 0, -1,  t, 0, 1,  -t, 0, -1,  -t, 0, 1
+    };
+    // Same winding as generateSphere
+    indices = {
+        0, 5, 11,  0, 1, 5,  0, 7, 1,  0, 10, 7,  0, 11, 10,
+        1, 9, 5,  5, 4, 11,  11, 2, 10,  10, 6, 7,  7, 8, 1,
+        3, 4, 9,  3, 2, 4,  3, 6, 2,  3, 8, 6,  3, 9, 8,
+        4, 5, 9,  2, 11, 4,  6, 10, 2,  8, 7, 6,  9, 1, 8
+    };
+
+    auto normalizePoint = [&](int i) {
+        float* p = &points[i * 3];
+        float length = std::sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+        p[0] /= length;
+        p[1] /= length;
+        p[2] /= length;
+    };
+    for (int i = 0; i < 12; ++i)
+        normalizePoint(i);
+
+    for (int level = 0; level < subdivisions; ++level)
+    {
+        std::map<std::pair<unsigned int, unsigned int>, unsigned int> midpoints;
+        auto midpoint = [&](unsigned int a, unsigned int b) {
+            std::pair<unsigned int, unsigned int> key(std::min(a, b), std::max(a, b));
+            auto it = midpoints.find(key);
+            if (it != midpoints.end())
+                return it->second;
+            unsigned int index = (unsigned int)(points.size() / 3);
+            for (int c = 0; c < 3; ++c)
+                points.push_back(0.5f * (points[a * 3 + c] + points[b * 3 + c]));
+            normalizePoint(index);
+            midpoints[key] = index;
+            return index;
+        };
+
+        std::vector<unsigned int> refined;
+        refined.reserve(indices.size() * 4);
+        for (size_t i = 0; i < indices.size(); i += 3)
+        {
+            unsigned int a = indices[i], b = indices[i + 1], c = indices[i + 2];
+            unsigned int ab = midpoint(a, b), bc = midpoint(b, c), ca = midpoint(c, a);
+            unsigned int faces[] = { a, ab, ca,  b, bc, ab,  c, ca, bc,  ab, bc, ca };
+            refined.insert(refined.end(), faces, faces + 12);
+        }
+        indices.swap(refined);
+    }
+
+    vertices.clear();
+    vertices.reserve(points.size() / 3 * 8);
+    for (size_t i = 0; i < points.size(); i += 3)
+    {
+        float x = points[i], y = points[i + 1], z = points[i + 2];
+        float u = std::atan2(z, x) / (2.0f * kPi);
+        if (u < 0.0f)
+            u += 1.0f;
+        float v = std::acos(std::max(-1.0f, std::min(1.0f, y))) / kPi;
+        float vertex[] = { x * radius, y * radius, z * radius, x, y, z, u, v };
+        vertices.insert(vertices.end(), vertex, vertex + 8);
+    }
+}
+
+// Unit cube as 36 unrolled vertices, six per face
+const float cubeVertices[] = {
+    // Position          // Normals           // Texture coordinates
+    -0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f, 0.0f,
+     0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f, 0.0f,
+     0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f, 1.0f,
+     0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f, 1.0f,
+    -0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f, 1.0f,
+    -0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f, 0.0f,
+
+    -0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  0.0f, 0.0f,
+     0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  1.0f, 0.0f,
+     0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  1.0f, 1.0f,
+     0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  1.0f, 1.0f,
+    -0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  0.0f, 1.0f,
+    -0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  0.0f, 0.0f,
+
+    -0.5f,  0.5f,  0.5f, -1.0f,  0.0f,  0.0f,  1.0f, 0.0f,
+    -0.5f,  0.5f, -0.5f, -1.0f,  0.0f,  0.0f,  1.0f, 1.0f,
+    -0.5f, -0.5f, -0.5f, -1.0f,  0.0f,  0.0f,  0.0f, 1.0f,
+    -0.5f, -0.5f, -0.5f, -1.0f,  0.0f,  0.0f,  0.0f, 1.0f,
+    -0.5f, -0.5f,  0.5f, -1.0f,  0.0f,  0.0f,  0.0f, 0.0f,
+    -0.5f,  0.5f,  0.5f, -1.0f,  0.0f,  0.0f,  1.0f, 0.0f,
+
+     0.5f,  0.5f,  0.5f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f,
+     0.5f,  0.5f, -0.5f,  1.0f,  0.0f,  0.0f,  1.0f, 1.0f,
+     0.5f, -0.5f, -0.5f,  1.0f,  0.0f,  0.0f,  0.0f, 1.0f,
+     0.5f, -0.5f, -0.5f,  1.0f,  0.0f,  0.0f,  0.0f, 1.0f,
+     0.5f, -0.5f,  0.5f,  1.0f,  0.0f,  0.0f,  0.0f, 0.0f,
+     0.5f,  0.5f,  0.5f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f,
+
+    -0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,  0.0f, 1.0f,
+     0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,  1.0f, 1.0f,
+     0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,  1.0f, 0.0f,
+     0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,  1.0f, 0.0f,
+    -0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,  0.0f, 0.0f,
+    -0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,  0.0f, 1.0f,
+
+    -0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,  0.0f, 1.0f,
+     0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,  1.0f, 1.0f,
+     0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,  1.0f, 0.0f,
+     0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,  1.0f, 0.0f,
+    -0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,  0.0f, 0.0f,
+    -0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,  0.0f, 1.0f
+};
+
+// The cube as the indexed mesh the renderer uploads: 24 vertices after deduplication
+inline void buildCubeMesh(std::vector<float>& vertices, std::vector<unsigned int>& indices)
+{
+    vertices.assign(cubeVertices, cubeVertices + sizeof(cubeVertices) / sizeof(float));
+    indices.resize(vertices.size() / 8);
+    for (size_t i = 0; i < indices.size(); ++i)
+        indices[i] = (unsigned int)i;
+    optimizeMesh(vertices, indices);
+}
+
+// ---------------------------------------------------------------------------
+// Sphere level-of-detail chain. All levels share one vertex array and one 16-bit
+// index array; each level records where its indices start. Indices are global,
+// so every level is drawn from the same VBO/EBO without a base vertex. Each level
+// goes through optimizeMesh() before it is appended.
+
+struct MeshLod
+{
+    int firstIndex;
+    int indexCount;
+    int vertexCount;
+};
+
+struct SphereLodChain
+{
+    std::vector<float> vertices;
+    std::vector<unsigned short> indices;
+    std::vector<MeshLod> lods;
+
+    // Minimum projected radius in pixels for each level; the last level is the fallback
+    std::vector<float> minPixelRadius;
+};
+
+inline SphereLodChain buildSphereLodChain(float radius)
+{
+    SphereLodChain chain;
+
+    auto appendLevel = [&](std::vector<float>& vertices, std::vector<unsigned int>& indices, float minPixels) {
+        optimizeMesh(vertices, indices);
+        unsigned int baseVertex = (unsigned int)(chain.vertices.size() / 8);
+        MeshLod lod;
+        lod.firstIndex = (int)chain.indices.size();
+        lod.indexCount = (int)indices.size();
+        lod.vertexCount = (int)(vertices.size() / 8);
+        chain.vertices.insert(chain.vertices.end(), vertices.begin(), vertices.end());
+        for (unsigned int index : indices)
+            chain.indices.push_back((unsigned short)(baseVertex + index));
+        chain.lods.push_back(lod);
+        chain.minPixelRadius.push_back(minPixels);
+    };
+
+    std::vector<float> vertices;
+    std::vector<unsigned int> indices;
+    generateSphere(radius, 32, 32, vertices, indices);
+    appendLevel(vertices, indices, 96.0f);
+    generateSphere(radius, 16, 16, vertices, indices);
+    appendLevel(vertices, indices, 32.0f);
+    generateSphere(radius, 10, 8, vertices, indices);
+    appendLevel(vertices, indices, 12.0f);
+    generateIcosphere(radius, 1, vertices, indices);
+    appendLevel(vertices, indices, 4.0f);
+    generateIcosphere(radius, 0, vertices, indices);
+    appendLevel(vertices, indices, 0.0f);
+    return chain;
+}
+
+// Screen-space radius in pixels of a sphere at the given view distance.
+// pixelScale is projection[1][1] * viewportHeight / 2.
+inline float projectedRadius(float radius, float distance, float pixelScale)
+{
+    return radius * pixelScale / std::max(distance, 1e-4f);
+}
+
+// Picks a level for the projected radius. The current level is kept while the radius
+// stays within `hysteresis` (a fraction) of its range, so objects hovering around a
+// threshold do not flip between levels every frame.
+inline int selectLod(const std::vector<float>& minPixelRadius, int currentLod, float pixelRadius, float hysteresis = 0.15f)
+{
+    int last = (int)minPixelRadius.size() - 1;
+    if (currentLod >= 0 && currentLod <= last)
+    {
+        float lower = minPixelRadius[currentLod] * (1.0f - hysteresis);
+        float upper = currentLod > 0 ? minPixelRadius[currentLod - 1] * (1.0f + hysteresis) : INFINITY;
+        if (pixelRadius >= lower && pixelRadius < upper)
+            return currentLod;
+    }
+
+    for (int lod = 0; lod < last; ++lod)
+    {
+        if (pixelRadius >= minPixelRadius[lod])
+            return lod;
+    }
+    return last;
+}
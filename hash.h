@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// FNV-1a, 64-bit. Pass a previous result as `hash` to continue over more data.
+const uint64_t kHashSeed = 14695981039346656037ull;
+
+inline uint64_t hashBytes(const void* data, size_t size, uint64_t hash = kHashSeed)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <iostream>
+
+// Offscreen OpenGL context for machines without a display (CI, Mesa llvmpipe).
+// Uses an EGL surfaceless context when available and a pbuffer otherwise; the
+// scene is always rendered into an FBO so both paths behave the same.
+struct HeadlessContext
+{
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLContext context = EGL_NO_CONTEXT;
+    EGLSurface surface = EGL_NO_SURFACE;
+    GLuint fbo = 0;
+    GLuint colorBuffer = 0;
+    GLuint depthBuffer = 0;
+    int width = 0;
+    int height = 0;
+};
+
+inline EGLDisplay getHeadlessDisplay()
+{
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay)
+    {
+        EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+        if (display != EGL_NO_DISPLAY && eglInitialize(display, nullptr, nullptr))
+            return display;
+    }
+
+    EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (display != EGL_NO_DISPLAY && eglInitialize(display, nullptr, nullptr))
+        return display;
+    return EGL_NO_DISPLAY;
+}
+
+// Creates the EGL context and makes it current. The FBO needs GL entry points,
+// so it is created after glewInit() in createHeadlessFramebuffer().
+inline bool createHeadlessContext(HeadlessContext& ctx, int width, int height)
+{
+    ctx.width = width;
+    ctx.height = height;
+
+    ctx.display = getHeadlessDisplay();
+    if (ctx.display == EGL_NO_DISPLAY)
+    {
+        std::cerr << "Failed to open an EGL display\n";
+        return false;
+    }
+
+    if (!eglBindAPI(EGL_OPENGL_API))
+    {
+        std::cerr << "EGL does not support desktop OpenGL\n";
+        return false;
+    }
+
+    const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+        EGL_DEPTH_SIZE, 24,
+        EGL_NONE
+    };
+    EGLConfig config = nullptr;
+    EGLint configCount = 0;
+    eglChooseConfig(ctx.display, configAttribs, &config, 1, &configCount);
+
+    const EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    // Surfaceless displays expose no configs; EGL_KHR_no_config_context covers that case
+    ctx.context = eglCreateContext(ctx.display, configCount > 0 ? config : EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, contextAttribs);
+    if (ctx.context == EGL_NO_CONTEXT)
+    {
+        std::cerr << "Failed to create an EGL OpenGL 3.3 context\n";
+        return false;
+    }
+
+    if (configCount > 0)
+    {
+        const EGLint pbufferAttribs[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+        ctx.surface = eglCreatePbufferSurface(ctx.display, config, pbufferAttribs);
+    }
+
+    if (!eglMakeCurrent(ctx.display, ctx.surface, ctx.surface, ctx.context))
+    {
+        std::cerr << "Failed to make the EGL context current\n";
+        return false;
+    }
+    return true;
+}
+
+inline bool createHeadlessFramebuffer(HeadlessContext& ctx)
+{
+    glGenFramebuffers(1, &ctx.fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, ctx.fbo);
+
+    glGenRenderbuffers(1, &ctx.colorBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, ctx.colorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, ctx.width, ctx.height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, ctx.colorBuffer);
+
+    glGenRenderbuffers(1, &ctx.depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, ctx.depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, ctx.width, ctx.height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, ctx.depthBuffer);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        std::cerr << "Offscreen framebuffer is incomplete\n";
+        return false;
+    }
+    glViewport(0, 0, ctx.width, ctx.height);
+    return true;
+}
+
+inline void destroyHeadlessContext(HeadlessContext& ctx)
+{
+    if (ctx.fbo)
+    {
+        glDeleteFramebuffers(1, &ctx.fbo);
+        glDeleteRenderbuffers(1, &ctx.colorBuffer);
+        glDeleteRenderbuffers(1, &ctx.depthBuffer);
+    }
+    if (ctx.display != EGL_NO_DISPLAY)
+    {
+        eglMakeCurrent(ctx.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (ctx.surface != EGL_NO_SURFACE)
+            eglDestroySurface(ctx.display, ctx.surface);
+        if (ctx.context != EGL_NO_CONTEXT)
+            eglDestroyContext(ctx.display, ctx.context);
+        eglTerminate(ctx.display);
+    }
+    ctx = HeadlessContext();
+}
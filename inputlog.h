@@ -0,0 +1,197 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "mappedfile.h"
+
+// Input log (--record / --replay). A windowed run records, per frame, everything the
+// camera and the animation were driven by: the render time, the simulation tick whose
+// snapshot was drawn, the frame's deltaTime, the cursor events delivered to
+// mouse_callback and the keys processInput saw. Replaying the log headlessly advances
+// the simulation to the same tick and feeds the same events through the same code, so
+// every frame is rendered from the same camera and simulation state.
+//
+//     InputLogHeader
+//     the recorded command line: argumentBytes of null-terminated arguments
+//     per frame: InputLogFrame, then cursorEvents x InputLogCursor
+//
+// Frames are appended as they happen; the frame count is whatever the file holds. The
+// header holds the only framebuffer size, so a recording ends when the window is resized.
+
+enum InputKeys : uint8_t
+{
+    InputKeyForward = 1,     // W
+    InputKeyBack = 2,        // S
+    InputKeyLeft = 4,        // A
+    InputKeyRight = 8,       // D
+    InputKeyProfile = 16,    // P
+    InputKeyOverdraw = 32    // O
+};
+
+struct InputLogHeader
+{
+    char magic[4];
+    uint32_t version;
+    double tickSeconds;
+    int32_t width;
+    int32_t height;
+    uint32_t argumentBytes;
+    uint32_t reserved;
+};
+
+struct InputLogFrame
+{
+    double time;           // render time on the simulation clock
+    uint64_t tick;         // newest tick of the snapshot that was drawn
+    float deltaTime;
+    uint16_t cursorEvents;
+    uint8_t keys;          // InputKeys held while processInput ran
+    uint8_t reserved;
+};
+
+struct InputLogCursor
+{
+    double x;
+    double y;
+};
+
+const char kInputLogMagic[4] = { 'I', 'N', 'P', 'T' };
+const uint32_t kInputLogVersion = 1;
+
+class InputLogWriter
+{
+public:
+    bool open(const std::string& path, double tickSeconds, int width, int height, const std::vector<std::string>& arguments)
+    {
+        out.open(path, std::ios::binary | std::ios::trunc);
+        if (!out)
+            return false;
+        std::string packed;
+        for (const std::string& argument : arguments)
+        {
+            packed += argument;
+            packed += '\0';
+        }
+        InputLogHeader header = {};
+        std::memcpy(header.magic, kInputLogMagic, sizeof(kInputLogMagic));
+        header.version = kInputLogVersion;
+        header.tickSeconds = tickSeconds;
+        header.width = width;
+        header.height = height;
+        header.argumentBytes = (uint32_t)packed.size();
+        out.write((const char*)&header, sizeof(header));
+        out.write(packed.data(), packed.size());
+        return (bool)out;
+    }
+
+    bool isOpen() const { return out.is_open(); }
+
+    // Cursor events arrive through mouse_callback while events are polled
+    void cursor(double x, double y)
+    {
+        if (out.is_open() && cursors.size() < 0xFFFF)
+            cursors.push_back({ x, y });
+    }
+
+    void endFrame(double time, uint64_t tick, float deltaTime, uint8_t keys)
+    {
+        if (!out.is_open())
+            return;
+        InputLogFrame frame = {};
+        frame.time = time;
+        frame.tick = tick;
+        frame.deltaTime = deltaTime;
+        frame.cursorEvents = (uint16_t)cursors.size();
+        frame.keys = keys;
+        out.write((const char*)&frame, sizeof(frame));
+        out.write((const char*)cursors.data(), cursors.size() * sizeof(InputLogCursor));
+        cursors.clear();
+    }
+
+    void close() { out.close(); }
+
+private:
+    std::ofstream out;
+    std::vector<InputLogCursor> cursors;
+};
+
+// A whole log read back for replay
+struct InputLog
+{
+    double tickSeconds = 0.0;
+    int width = 0;
+    int height = 0;
+    std::vector<std::string> arguments;
+    std::vector<InputLogFrame> frames;
+    std::vector<InputLogCursor> cursors;
+    std::vector<size_t> firstCursor;    // per frame, into cursors
+};
+
+inline bool loadInputLog(const std::string& path, InputLog& log, std::string& error)
+{
+    std::vector<unsigned char> bytes;
+    if (!readFile(path, bytes))
+    {
+        error = "cannot open " + path;
+        return false;
+    }
+    InputLogHeader header;
+    if (bytes.size() < sizeof(header) || std::memcmp(bytes.data(), kInputLogMagic, sizeof(kInputLogMagic)) != 0)
+    {
+        error = "not an input log";
+        return false;
+    }
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    if (header.version != kInputLogVersion)
+    {
+        error = "input log version " + std::to_string(header.version) + ", expected " + std::to_string(kInputLogVersion);
+        return false;
+    }
+    size_t offset = sizeof(header);
+    if (header.argumentBytes > bytes.size() - offset || header.tickSeconds <= 0.0 || header.width <= 0 || header.height <= 0)
+    {
+        error = "input log header is corrupt";
+        return false;
+    }
+
+    log = InputLog();
+    log.tickSeconds = header.tickSeconds;
+    log.width = header.width;
+    log.height = header.height;
+    const char* arguments = (const char*)bytes.data() + offset;
+    for (size_t begin = 0, end; begin < header.argumentBytes; begin = end + 1)
+    {
+        end = begin;
+        while (end < header.argumentBytes && arguments[end] != '\0')
+            ++end;
+        log.arguments.emplace_back(arguments + begin, end - begin);
+    }
+    offset += header.argumentBytes;
+
+    // A run that was killed can leave a partial frame at the end; it is dropped
+    while (bytes.size() - offset >= sizeof(InputLogFrame))
+    {
+        InputLogFrame frame;
+        std::memcpy(&frame, bytes.data() + offset, sizeof(frame));
+        size_t cursorBytes = frame.cursorEvents * sizeof(InputLogCursor);
+        if (cursorBytes > bytes.size() - offset - sizeof(frame))
+            break;
+        offset += sizeof(frame);
+        log.firstCursor.push_back(log.cursors.size());
+        log.cursors.resize(log.cursors.size() + frame.cursorEvents);
+        if (cursorBytes > 0)
+            std::memcpy(log.cursors.data() + log.firstCursor.back(), bytes.data() + offset, cursorBytes);
+        offset += cursorBytes;
+        log.frames.push_back(frame);
+    }
+    if (log.frames.empty())
+    {
+        error = "input log has no frames";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,311 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "profiler.h"
+#include "shader.h"
+#include "streambuffer.h"
+#include "threadpool.h"
+
+// Clustered forward lighting. The view frustum is split into kClusterGridX x
+// kClusterGridY screen tiles times kClusterGridZ depth slices, spaced exponentially
+// from kClusterNear to the far plane. Every frame the point lights are binned into
+// the clusters they can reach (one depth slice per pool task) and three texture
+// buffers are uploaded:
+//
+//     lightData       RGBA32F, two texels per light: position + radius, colour
+//     clusterRanges   RG32UI, per cluster: first entry in clusterIndices, light count
+//     clusterIndices  R32UI, light indices grouped by cluster
+//
+// computeLighting() in the shader header finds the fragment's cluster from
+// gl_FragCoord and its view depth, and shades only the lights listed there.
+//
+// The buffers are written in place. With ARB_texture_buffer_range each one is a
+// StreamBuffer and the texture views this frame's range; plain GL 3.3 texture buffers
+// always start at offset 0, so there each buffer is orphaned and mapped whole instead.
+
+struct PointLight
+{
+    glm::vec3 position;
+    float radius;    // no contribution beyond this distance
+    glm::vec3 color;
+};
+
+const int kClusterGridX = 16;
+const int kClusterGridY = 9;
+const int kClusterGridZ = 24;
+const int kClusterCount = kClusterGridX * kClusterGridY * kClusterGridZ;
+const float kClusterNear = 0.1f;
+
+// Texture units the cluster buffers stay bound to
+const int kLightDataUnit = 2;
+const int kClusterRangesUnit = 3;
+const int kClusterIndicesUnit = 4;
+const int kClusterBufferUnits[3] = { kLightDataUnit, kClusterRangesUnit, kClusterIndicesUnit };
+const GLenum kClusterBufferFormats[3] = { GL_RGBA32F, GL_RG32UI, GL_R32UI };
+
+struct ClusterStats
+{
+    int lights = 0;
+    int references = 0;      // light indices over all clusters
+    int maxPerCluster = 0;
+};
+
+struct LightClusters
+{
+    enum { LightData, ClusterRanges, ClusterIndices, BufferCount };
+    bool textureRanges = false;
+    StreamBuffer streams[BufferCount];    // with texture ranges
+    GLuint buffers[BufferCount] = {};     // without
+    GLuint textures[BufferCount] = {};
+    float farPlane = 100.0f;
+
+    // Tile size in pixels and the log-depth slice mapping, uploaded with FrameData
+    glm::vec4 scale;
+
+    std::vector<glm::vec3> viewLights;    // view-space x, y and depth per light
+
+    // Per depth slice: lights overlapping each tile, grouped by tile
+    struct Hit
+    {
+        uint32_t light;
+        int16_t x0, x1, y0, y1;
+    };
+    struct Slice
+    {
+        std::vector<Hit> hits;
+        std::vector<uint32_t> tileOffsets;
+        std::vector<uint32_t> indices;
+    };
+    std::vector<Slice> slices;
+};
+
+inline LightClusters createLightClusters(float farPlane)
+{
+    LightClusters clusters;
+    clusters.farPlane = farPlane;
+    clusters.slices.resize(kClusterGridZ);
+    clusters.textureRanges = GLEW_ARB_texture_buffer_range;
+    glGenTextures(LightClusters::BufferCount, clusters.textures);
+
+    GLint alignment = 16;
+    if (clusters.textureRanges)
+        glGetIntegerv(GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    else
+        glGenBuffers(LightClusters::BufferCount, clusters.buffers);
+    const size_t initialBytes[LightClusters::BufferCount] = { 1024 * 2 * sizeof(glm::vec4), kClusterCount * 2 * sizeof(uint32_t),
+                                                              kClusterCount * 8 * sizeof(uint32_t) };
+    for (int i = 0; i < LightClusters::BufferCount; ++i)
+    {
+        glActiveTexture(GL_TEXTURE0 + kClusterBufferUnits[i]);
+        glBindTexture(GL_TEXTURE_BUFFER, clusters.textures[i]);
+        if (clusters.textureRanges)
+        {
+            clusters.streams[i].create(initialBytes[i], (size_t)std::max(alignment, 16));
+            continue;
+        }
+        // Start non-empty; a texture buffer over zero bytes is incomplete
+        glBindBuffer(GL_TEXTURE_BUFFER, clusters.buffers[i]);
+        glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+        glTexBuffer(GL_TEXTURE_BUFFER, kClusterBufferFormats[i], clusters.buffers[i]);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glActiveTexture(GL_TEXTURE0);
+    return clusters;
+}
+
+// Points a program's cluster samplers at their units; programs that do no lighting are skipped
+inline void bindLightingSamplers(const ShaderProgram& program)
+{
+    const char* names[3] = { "lightData", "clusterRanges", "clusterIndices" };
+    glUseProgram(program.id);
+    for (int i = 0; i < 3; ++i)
+    {
+        auto found = program.locations.find(names[i]);
+        if (found != program.locations.end())
+            glUniform1i(found->second, kClusterBufferUnits[i]);
+    }
+    glUseProgram(0);
+}
+
+// Depth range covered by a slice; the first and last slices are open-ended
+inline float clusterSliceNear(const LightClusters& clusters, int slice)
+{
+    return slice == 0 ? 0.0f : kClusterNear * std::pow(clusters.farPlane / kClusterNear, slice / (float)kClusterGridZ);
+}
+
+inline float clusterSliceFar(const LightClusters& clusters, int slice)
+{
+    return slice == kClusterGridZ - 1 ? INFINITY : kClusterNear * std::pow(clusters.farPlane / kClusterNear, (slice + 1) / (float)kClusterGridZ);
+}
+
+// Bins the lights into clusters for this view and uploads the three buffers.
+// projection must be a symmetric perspective matrix.
+inline void updateLightClusters(LightClusters& clusters, const std::vector<PointLight>& lights, const glm::mat4& view,
+                                const glm::mat4& projection, int viewportWidth, int viewportHeight, ThreadPool* pool,
+                                ClusterStats& stats)
+{
+    int tileWidth = (viewportWidth + kClusterGridX - 1) / kClusterGridX;
+    int tileHeight = (viewportHeight + kClusterGridY - 1) / kClusterGridY;
+    float logRange = std::log(clusters.farPlane / kClusterNear);
+    clusters.scale = glm::vec4((float)tileWidth, (float)tileHeight, kClusterGridZ / logRange,
+                               -kClusterGridZ * std::log(kClusterNear) / logRange);
+
+    clusters.viewLights.resize(lights.size());
+    for (size_t i = 0; i < lights.size(); ++i)
+    {
+        glm::vec4 viewPosition = view * glm::vec4(lights[i].position, 1.0f);
+        clusters.viewLights[i] = glm::vec3(viewPosition.x, viewPosition.y, -viewPosition.z);
+    }
+
+    // NDC to tile index along one axis
+    float scaleX = projection[0][0], scaleY = projection[1][1];
+    auto tileIndex = [](float ndc, int viewport, int tileSize, int gridSize) {
+        float pixel = (ndc * 0.5f + 0.5f) * viewport;
+        return (int16_t)std::max(0.0f, std::min((float)(gridSize - 1), std::floor(pixel / tileSize)));
+    };
+
+    const int tileCount = kClusterGridX * kClusterGridY;
+    auto binSlices = [&](size_t sliceBegin, size_t sliceEnd) {
+        ProfileZone zone("lights.bin");
+        for (size_t z = sliceBegin; z < sliceEnd; ++z)
+        {
+            LightClusters::Slice& slice = clusters.slices[z];
+            slice.hits.clear();
+            slice.tileOffsets.assign(tileCount + 1, 0);
+            float sliceNear = clusterSliceNear(clusters, (int)z);
+            float sliceFar = clusterSliceFar(clusters, (int)z);
+
+            for (size_t i = 0; i < lights.size(); ++i)
+            {
+                const glm::vec3& p = clusters.viewLights[i];
+                float radius = lights[i].radius;
+                float nearDepth = std::max(p.z - radius, sliceNear);
+                float farDepth = std::min(p.z + radius, sliceFar);
+                if (nearDepth > farDepth || farDepth <= 0.0f)
+                    continue;
+
+                // Screen bounds of the light's box over this depth range: each edge
+                // projects furthest out at whichever end of the range is closer to the eye
+                float d0 = std::max(nearDepth, 1e-4f);
+                float d1 = std::max(farDepth, d0);
+                float minX = p.x - radius, maxX = p.x + radius;
+                float minY = p.y - radius, maxY = p.y + radius;
+                float ndcMinX = scaleX * minX / (minX < 0.0f ? d0 : d1);
+                float ndcMaxX = scaleX * maxX / (maxX > 0.0f ? d0 : d1);
+                float ndcMinY = scaleY * minY / (minY < 0.0f ? d0 : d1);
+                float ndcMaxY = scaleY * maxY / (maxY > 0.0f ? d0 : d1);
+                if (ndcMaxX < -1.0f || ndcMinX > 1.0f || ndcMaxY < -1.0f || ndcMinY > 1.0f)
+                    continue;
+
+                LightClusters::Hit hit;
+                hit.light = (uint32_t)i;
+                hit.x0 = tileIndex(ndcMinX, viewportWidth, tileWidth, kClusterGridX);
+                hit.x1 = tileIndex(ndcMaxX, viewportWidth, tileWidth, kClusterGridX);
+                hit.y0 = tileIndex(ndcMinY, viewportHeight, tileHeight, kClusterGridY);
+                hit.y1 = tileIndex(ndcMaxY, viewportHeight, tileHeight, kClusterGridY);
+                slice.hits.push_back(hit);
+                for (int y = hit.y0; y <= hit.y1; ++y)
+                    for (int x = hit.x0; x <= hit.x1; ++x)
+                        ++slice.tileOffsets[y * kClusterGridX + x + 1];
+            }
+
+            for (int t = 0; t < tileCount; ++t)
+                slice.tileOffsets[t + 1] += slice.tileOffsets[t];
+            slice.indices.resize(slice.tileOffsets[tileCount]);
+            std::vector<uint32_t> fill(slice.tileOffsets.begin(), slice.tileOffsets.end() - 1);
+            for (const LightClusters::Hit& hit : slice.hits)
+            {
+                for (int y = hit.y0; y <= hit.y1; ++y)
+                    for (int x = hit.x0; x <= hit.x1; ++x)
+                        slice.indices[fill[y * kClusterGridX + x]++] = hit.light;
+            }
+        }
+    };
+    if (pool)
+        pool->parallelFor(kClusterGridZ, 1, binSlices);
+    else
+        binSlices(0, kClusterGridZ);
+
+    // Maps one buffer for writing `size` bytes and points its texture at them
+    auto map = [&](int buffer, size_t size) -> void* {
+        glActiveTexture(GL_TEXTURE0 + kClusterBufferUnits[buffer]);
+        if (clusters.textureRanges)
+        {
+            StreamAllocation allocation = clusters.streams[buffer].allocate(size);
+            glTexBufferRange(GL_TEXTURE_BUFFER, kClusterBufferFormats[buffer], clusters.streams[buffer].buffer(),
+                             allocation.offset, allocation.size);
+            return allocation.data;
+        }
+        glBindBuffer(GL_TEXTURE_BUFFER, clusters.buffers[buffer]);
+        glBufferData(GL_TEXTURE_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        return glMapBufferRange(GL_TEXTURE_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    };
+    auto unmap = [&](int buffer) {
+        if (clusters.textureRanges)
+        {
+            clusters.streams[buffer].unmap();
+            return;
+        }
+        glBindBuffer(GL_TEXTURE_BUFFER, clusters.buffers[buffer]);
+        glUnmapBuffer(GL_TEXTURE_BUFFER);
+    };
+
+    if (glm::vec4* lightData = (glm::vec4*)map(LightClusters::LightData, std::max<size_t>(1, lights.size() * 2) * sizeof(glm::vec4)))
+    {
+        for (size_t i = 0; i < lights.size(); ++i)
+        {
+            lightData[i * 2] = glm::vec4(lights[i].position, lights[i].radius);
+            lightData[i * 2 + 1] = glm::vec4(lights[i].color, 0.0f);
+        }
+    }
+    unmap(LightClusters::LightData);
+
+    // Concatenate the slices; cluster index is (z * gridY + y) * gridX + x
+    stats.lights = (int)lights.size();
+    stats.references = 0;
+    stats.maxPerCluster = 0;
+    for (const LightClusters::Slice& slice : clusters.slices)
+        stats.references += (int)slice.indices.size();
+
+    if (uint32_t* ranges = (uint32_t*)map(LightClusters::ClusterRanges, kClusterCount * 2 * sizeof(uint32_t)))
+    {
+        uint32_t base = 0;
+        for (int z = 0; z < kClusterGridZ; ++z)
+        {
+            const LightClusters::Slice& slice = clusters.slices[z];
+            for (int t = 0; t < tileCount; ++t)
+            {
+                uint32_t count = slice.tileOffsets[t + 1] - slice.tileOffsets[t];
+                ranges[(z * tileCount + t) * 2] = base + slice.tileOffsets[t];
+                ranges[(z * tileCount + t) * 2 + 1] = count;
+                stats.maxPerCluster = std::max(stats.maxPerCluster, (int)count);
+            }
+            base += (uint32_t)slice.indices.size();
+        }
+    }
+    unmap(LightClusters::ClusterRanges);
+
+    if (uint32_t* indices = (uint32_t*)map(LightClusters::ClusterIndices, std::max(1, stats.references) * sizeof(uint32_t)))
+    {
+        for (const LightClusters::Slice& slice : clusters.slices)
+            indices = std::copy(slice.indices.begin(), slice.indices.end(), indices);
+    }
+    unmap(LightClusters::ClusterIndices);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+inline void destroyLightClusters(LightClusters& clusters)
+{
+    glDeleteTextures(LightClusters::BufferCount, clusters.textures);
+    glDeleteBuffers(LightClusters::BufferCount, clusters.buffers);
+    for (StreamBuffer& stream : clusters.streams)
+        stream.destroy();
+    clusters = LightClusters();
+}
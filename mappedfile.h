@@ -0,0 +1,85 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+inline bool readFile(const std::string& path, std::vector<unsigned char>& bytes)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept { *this = std::move(other); }
+    MappedFile& operator=(MappedFile&& other) noexcept
+    {
+        std::swap(mapping, other.mapping);
+        std::swap(length, other.length);
+        return *this;
+    }
+    ~MappedFile() { close(); }
+
+    bool open(const std::string& path)
+    {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0)
+        {
+            void* address = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (address != MAP_FAILED)
+            {
+                mapping = address;
+                length = (size_t)info.st_size;
+            }
+        }
+        ::close(fd);
+        return mapping != nullptr;
+    }
+
+    void close()
+    {
+        if (mapping)
+            munmap(mapping, length);
+        mapping = nullptr;
+        length = 0;
+    }
+
+    // Asks the kernel to start reading a range in the background
+    void prefetch(size_t offset, size_t size) const
+    {
+        if (!mapping || offset >= length)
+            return;
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t begin = offset & ~(page - 1);
+        size_t end = std::min(length, offset + size);
+        madvise((char*)mapping + begin, end - begin, MADV_WILLNEED);
+    }
+
+    const unsigned char* data() const { return (const unsigned char*)mapping; }
+    size_t size() const { return length; }
+
+private:
+    void* mapping = nullptr;
+    size_t length = 0;
+};
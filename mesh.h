@@ -0,0 +1,364 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <vector>
+
+// Mesh building pipeline. Meshes are generated as 8-float vertices (position,
+// normal, texture coordinates) with 32-bit indices, then deduplicated, reordered
+// for the post-transform vertex cache and for fetch locality, and finally packed
+// into 16-byte vertices for upload:
+//
+//     position   3 x half float (+ 1 pad)   8 bytes
+//     normal     octahedral, 2 x snorm16     4 bytes
+//     texcoord   2 x unorm16                 4 bytes
+//
+// Texture coordinates must lie in [0, 1]. Normals are decoded in the vertex
+// shader with decodeNormal() from the shared shader header.
+
+struct PackedVertex
+{
+    uint16_t position[4];
+    int16_t normal[2];
+    uint16_t texCoord[2];
+};
+
+// Largest decode error accepted by checkPackedVertices()
+const float kPackedPositionTolerance = 1e-3f;
+const float kPackedNormalTolerance = 1e-3f;
+const float kPackedTexCoordTolerance = 1e-4f;
+
+// Merges vertices whose eight attributes are bit-for-bit identical
+inline void deduplicateVertices(std::vector<float>& vertices, std::vector<unsigned int>& indices)
+{
+    std::map<std::array<float, 8>, unsigned int> unique;
+    std::vector<float> merged;
+    std::vector<unsigned int> remap(vertices.size() / 8);
+    merged.reserve(vertices.size());
+    for (size_t v = 0; v < remap.size(); ++v)
+    {
+        std::array<float, 8> key;
+        std::copy(vertices.begin() + v * 8, vertices.begin() + v * 8 + 8, key.begin());
+        auto inserted = unique.insert(std::make_pair(key, (unsigned int)(merged.size() / 8)));
+        if (inserted.second)
+            merged.insert(merged.end(), key.begin(), key.end());
+        remap[v] = inserted.first->second;
+    }
+    for (unsigned int& index : indices)
+        index = remap[index];
+    vertices.swap(merged);
+}
+
+// Reorders triangles for the post-transform vertex cache (Forsyth's linear-speed
+// algorithm). Vertices recently used and with few remaining triangles score highest,
+// and the triangle with the best total score is emitted next.
+inline void optimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount)
+{
+    const int kCacheSize = 32;
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    // Triangles using each vertex, as offsets into one adjacency array
+    std::vector<int> remaining(vertexCount, 0);
+    for (unsigned int index : indices)
+        ++remaining[index];
+    std::vector<int> adjacencyStart(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; ++v)
+        adjacencyStart[v + 1] = adjacencyStart[v] + remaining[v];
+    std::vector<int> adjacency(indices.size());
+    std::vector<int> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+    for (size_t i = 0; i < indices.size(); ++i)
+        adjacency[fill[indices[i]]++] = (int)(i / 3);
+
+    auto vertexScore = [&](int cachePosition, int activeTriangles) {
+        if (activeTriangles == 0)
+            return -1.0f;
+        float score = 0.0f;
+        if (cachePosition >= 0)
+        {
+            // The last triangle's vertices score the same so the order within it does not matter
+            if (cachePosition < 3)
+                score = 0.75f;
+            else
+                score = std::pow(1.0f - (cachePosition - 3) / (float)(kCacheSize - 3), 1.5f);
+        }
+        // Favour finishing off vertices with few triangles left
+        return score + 2.0f / std::sqrt((float)activeTriangles);
+    };
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> score(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v)
+        score[v] = vertexScore(-1, remaining[v]);
+    std::vector<float> triangleScore(triangleCount);
+    for (size_t t = 0; t < triangleCount; ++t)
+        triangleScore[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<unsigned int> ordered;
+    ordered.reserve(indices.size());
+    std::vector<unsigned int> cache, nextCache;
+    size_t scanCursor = 0;
+    int best = -1;
+
+    for (size_t step = 0; step < triangleCount; ++step)
+    {
+        // Nothing scored from the cache: continue with the next unemitted triangle in input order
+        if (best < 0)
+        {
+            while (emitted[scanCursor])
+                ++scanCursor;
+            best = (int)scanCursor;
+        }
+
+        emitted[best] = true;
+        nextCache.clear();
+        for (int k = 0; k < 3; ++k)
+        {
+            unsigned int v = indices[best * 3 + k];
+            ordered.push_back(v);
+            nextCache.push_back(v);
+
+            // Drop the triangle from the vertex's active list (once, for degenerate triangles)
+            int* begin = &adjacency[adjacencyStart[v]];
+            int* end = begin + remaining[v];
+            int* found = std::find(begin, end, best);
+            if (found != end)
+            {
+                std::swap(*found, *(end - 1));
+                --remaining[v];
+            }
+        }
+        for (unsigned int v : cache)
+        {
+            if (std::find(nextCache.begin(), nextCache.end(), v) == nextCache.end())
+                nextCache.push_back(v);
+        }
+
+        // Rescore everything that was or still is in the cache
+        for (size_t i = 0; i < nextCache.size(); ++i)
+        {
+            unsigned int v = nextCache[i];
+            cachePosition[v] = i < (size_t)kCacheSize ? (int)i : -1;
+            score[v] = vertexScore(cachePosition[v], remaining[v]);
+        }
+        best = -1;
+        float bestScore = -1.0f;
+        for (size_t i = 0; i < nextCache.size(); ++i)
+        {
+            unsigned int v = nextCache[i];
+            for (int a = adjacencyStart[v]; a < adjacencyStart[v] + remaining[v]; ++a)
+            {
+                int t = adjacency[a];
+                triangleScore[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+                if (triangleScore[t] > bestScore)
+                {
+                    bestScore = triangleScore[t];
+                    best = t;
+                }
+            }
+        }
+        if (nextCache.size() > (size_t)kCacheSize)
+            nextCache.resize(kCacheSize);
+        cache.swap(nextCache);
+    }
+    indices.swap(ordered);
+}
+
+// Renumbers vertices in the order the index buffer first uses them, so vertex fetches
+// walk memory forwards. Unreferenced vertices are dropped.
+inline void optimizeVertexFetch(std::vector<float>& vertices, std::vector<unsigned int>& indices)
+{
+    std::vector<unsigned int> remap(vertices.size() / 8, ~0u);
+    std::vector<float> ordered;
+    ordered.reserve(vertices.size());
+    for (unsigned int& index : indices)
+    {
+        if (remap[index] == ~0u)
+        {
+            remap[index] = (unsigned int)(ordered.size() / 8);
+            ordered.insert(ordered.end(), vertices.begin() + index * 8, vertices.begin() + index * 8 + 8);
+        }
+        index = remap[index];
+    }
+    vertices.swap(ordered);
+}
+
+inline void optimizeMesh(std::vector<float>& vertices, std::vector<unsigned int>& indices)
+{
+    deduplicateVertices(vertices, indices);
+    optimizeVertexCache(indices, vertices.size() / 8);
+    optimizeVertexFetch(vertices, indices);
+}
+
+// Round-to-nearest-even float to IEEE half conversion
+inline uint16_t floatToHalf(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, 4);
+    uint32_t sign = (bits >> 16) & 0x8000u;
+    uint32_t magnitude = bits & 0x7FFFFFFFu;
+
+    if (magnitude >= 0x7F800000u)
+        return (uint16_t)(sign | 0x7C00u | (magnitude > 0x7F800000u ? 0x200u : 0u));
+    if (magnitude >= 0x477FF000u)
+        return (uint16_t)(sign | 0x7C00u);
+    if (magnitude < 0x38800000u)
+    {
+        // Subnormal half: align the implicit-one mantissa to 2^-24 units and round
+        if (magnitude < 0x33000000u)
+            return (uint16_t)sign;
+        uint32_t exponent = magnitude >> 23;
+        uint32_t mantissa = (magnitude & 0x7FFFFFu) | 0x800000u;
+        uint32_t shift = 126 - exponent;
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1)))
+            ++half;
+        return (uint16_t)(sign | half);
+    }
+    uint32_t half = (magnitude - 0x38000000u) >> 13;
+    uint32_t rest = magnitude & 0x1FFFu;
+    if (rest > 0x1000u || (rest == 0x1000u && (half & 1)))
+        ++half;
+    return (uint16_t)(sign | half);
+}
+
+inline float halfToFloat(uint16_t half)
+{
+    uint32_t sign = (uint32_t)(half & 0x8000u) << 16;
+    uint32_t exponent = (half >> 10) & 0x1Fu;
+    uint32_t mantissa = half & 0x3FFu;
+    if (exponent == 0)
+    {
+        float value = std::ldexp((float)mantissa, -24);
+        return sign ? -value : value;
+    }
+    uint32_t bits = exponent == 0x1F ? sign | 0x7F800000u | (mantissa << 13)
+                                     : sign | ((exponent + 112) << 23) | (mantissa << 13);
+    float value;
+    std::memcpy(&value, &bits, 4);
+    return value;
+}
+
+inline int16_t floatToSnorm16(float value)
+{
+    return (int16_t)std::lround(std::max(-1.0f, std::min(1.0f, value)) * 32767.0f);
+}
+
+inline uint16_t floatToUnorm16(float value)
+{
+    return (uint16_t)std::lround(std::max(0.0f, std::min(1.0f, value)) * 65535.0f);
+}
+
+// Octahedral normal encoding: project onto the octahedron |x|+|y|+|z| = 1 and fold
+// the lower hemisphere over the diagonals into the unit square
+inline void encodeOctahedral(float x, float y, float z, int16_t encoded[2])
+{
+    float length = std::fabs(x) + std::fabs(y) + std::fabs(z);
+    float u = x / length;
+    float v = y / length;
+    if (z < 0.0f)
+    {
+        float foldedU = (1.0f - std::fabs(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+        float foldedV = (1.0f - std::fabs(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+        u = foldedU;
+        v = foldedV;
+    }
+    encoded[0] = floatToSnorm16(u);
+    encoded[1] = floatToSnorm16(v);
+}
+
+inline void decodeOctahedral(const int16_t encoded[2], float normal[3])
+{
+    float u = std::max(encoded[0] / 32767.0f, -1.0f);
+    float v = std::max(encoded[1] / 32767.0f, -1.0f);
+    float z = 1.0f - std::fabs(u) - std::fabs(v);
+    if (z < 0.0f)
+    {
+        float unfoldedU = (1.0f - std::fabs(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+        float unfoldedV = (1.0f - std::fabs(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+        u = unfoldedU;
+        v = unfoldedV;
+    }
+    float length = std::sqrt(u * u + v * v + z * z);
+    normal[0] = u / length;
+    normal[1] = v / length;
+    normal[2] = z / length;
+}
+
+inline std::vector<PackedVertex> packVertices(const std::vector<float>& vertices)
+{
+    std::vector<PackedVertex> packed(vertices.size() / 8);
+    for (size_t i = 0; i < packed.size(); ++i)
+    {
+        const float* v = &vertices[i * 8];
+        PackedVertex& p = packed[i];
+        p.position[0] = floatToHalf(v[0]);
+        p.position[1] = floatToHalf(v[1]);
+        p.position[2] = floatToHalf(v[2]);
+        p.position[3] = 0;
+        encodeOctahedral(v[3], v[4], v[5], p.normal);
+        p.texCoord[0] = floatToUnorm16(v[6]);
+        p.texCoord[1] = floatToUnorm16(v[7]);
+    }
+    return packed;
+}
+
+// Decodes every packed vertex and compares it with its source. Reports and returns
+// false when an attribute is off by more than its tolerance.
+inline bool checkPackedVertices(const std::vector<float>& vertices, const std::vector<PackedVertex>& packed, const char* name)
+{
+    if (packed.size() != vertices.size() / 8)
+    {
+        std::cerr << "Packed mesh " << name << " has " << packed.size() << " vertices, expected " << vertices.size() / 8
+                  << std::endl;
+        return false;
+    }
+    float positionError = 0.0f, normalError = 0.0f, texCoordError = 0.0f;
+    for (size_t i = 0; i < packed.size(); ++i)
+    {
+        const float* v = &vertices[i * 8];
+        const PackedVertex& p = packed[i];
+        for (int c = 0; c < 3; ++c)
+            positionError = std::max(positionError, std::fabs(halfToFloat(p.position[c]) - v[c]));
+
+        float normal[3];
+        decodeOctahedral(p.normal, normal);
+        float length = std::sqrt(v[3] * v[3] + v[4] * v[4] + v[5] * v[5]);
+        for (int c = 0; c < 3; ++c)
+            normalError = std::max(normalError, std::fabs(normal[c] - v[3 + c] / length));
+
+        for (int c = 0; c < 2; ++c)
+            texCoordError = std::max(texCoordError, std::fabs(p.texCoord[c] / 65535.0f - v[6 + c]));
+    }
+
+    bool ok = positionError <= kPackedPositionTolerance && normalError <= kPackedNormalTolerance &&
+              texCoordError <= kPackedTexCoordTolerance;
+    if (!ok)
+    {
+        std::cerr << "Packed mesh " << name << " exceeds decode tolerance: position " << positionError
+                  << ", normal " << normalError << ", texcoord " << texCoordError << std::endl;
+    }
+    return ok;
+}
+
+// Describes PackedVertex at attribute locations 0-2 for the bound GL_ARRAY_BUFFER
+inline void setPackedVertexAttributes()
+{
+    glVertexAttribPointer(0, 3, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, position));
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, normal));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, texCoord));
+    glEnableVertexAttribArray(2);
+}
@@ -0,0 +1,51 @@
+// Checks the 16-byte packed vertex format against the meshes the renderer builds.
+// Needs the GL headers but no context:
+//
+//     g++ -O2 mesh_check.cpp -o mesh_check
+//     ./mesh_check
+//
+// Every vertex of the cube and of the sphere LOD chain is packed, decoded again and
+// compared with its source within the tolerances in mesh.h. Also checks that every
+// index stays inside its mesh. Exits non-zero on the first mesh that fails.
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "culling.h"
+#include "geometry.h"
+
+bool checkMesh(const std::vector<float>& vertices, const std::vector<unsigned int>& indices, const std::string& name)
+{
+    size_t vertexCount = vertices.size() / 8;
+    for (unsigned int index : indices)
+    {
+        if (index >= vertexCount)
+        {
+            printf("%s: index %u out of range (%zu vertices) FAILED\n", name.c_str(), index, vertexCount);
+            return false;
+        }
+    }
+    if (!checkPackedVertices(vertices, packVertices(vertices), name.c_str()))
+    {
+        printf("%s: FAILED\n", name.c_str());
+        return false;
+    }
+    printf("%s: %zu vertices, %zu indices ok\n", name.c_str(), vertexCount, indices.size());
+    return true;
+}
+
+int main()
+{
+    std::vector<float> vertices;
+    std::vector<unsigned int> indices;
+    buildCubeMesh(vertices, indices);
+    if (!checkMesh(vertices, indices, "cube"))
+        return 1;
+
+    // The LODs share one vertex array, so it is packed and checked once
+    SphereLodChain sphere = buildSphereLodChain(kSphereRadius);
+    indices.assign(sphere.indices.begin(), sphere.indices.end());
+    if (!checkMesh(sphere.vertices, indices, "sphere, " + std::to_string(sphere.lods.size()) + " lods"))
+        return 1;
+    return 0;
+}
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_set>
+#include <vector>
+
+#include "culling.h"
+#include "shader.h"
+#include "simulation.h"
+
+// Hardware occlusion culling with latent results. Each frame the bounding box of
+// every candidate in the frustum is drawn against the frame's depth (after the depth
+// pre-pass, or after the opaque draws without one) inside a GL_ANY_SAMPLES_PASSED
+// query, with colour and depth writes off. The results are read at the start of the
+// next frame without waiting: objects whose box produced no samples are skipped for
+// that frame, but still queried, so they reappear one frame after they come into view.
+//
+// A result the GPU has not produced yet is not waited for. The object is drawn under
+// glBeginConditionalRender with the pending query instead, so the GPU can still skip it
+// once the query resolves. Query objects rotate through kOcclusionFrames sets, so a set
+// is never reissued while the GPU may still be working on it.
+//
+// Scene objects get a query each. Belt bodies are instanced, so they are tested per
+// cell of a world-space grid; a body is hidden when its cell's box was.
+
+const int kOcclusionFrames = 3;
+const float kOcclusionCellSize = 2.0f;
+const float kOcclusionCameraMargin = 0.05f;    // boxes this close to the eye are not tested
+
+const char* const kOcclusionBoxVertexSource = R"(
+layout(location = 0) in vec3 aCorner;
+uniform vec3 boxMin;
+uniform vec3 boxMax;
+
+void main() {
+    gl_Position = projectionMatrix * viewMatrix * vec4(mix(boxMin, boxMax, aCorner), 1.0);
+}
+)";
+
+const char* const kOcclusionBoxFragmentSource = R"(
+void main() {
+}
+)";
+
+struct OcclusionStats
+{
+    int queries = 0;
+    int objectsOccluded = 0;
+    int cellsOccluded = 0;
+    int pendingResults = 0;    // drawn under conditional render
+};
+
+class OcclusionCuller
+{
+public:
+    void create(const char* shaderHeader, const char* frameBlock, GLuint frameBinding, ProgramCache* cache = nullptr)
+    {
+        program = createShaderProgram(kOcclusionBoxVertexSource, kOcclusionBoxFragmentSource, shaderHeader, cache);
+        bindUniformBlock(program, frameBlock, frameBinding);
+        boxMinLocation = program.location("boxMin");
+        boxMaxLocation = program.location("boxMax");
+
+        // Unit cube corners, 12 triangles
+        const float corners[] = { 0, 0, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 0, 0, 1, 1, 0, 1, 1, 1, 1, 0, 1, 1 };
+        const unsigned char indices[] = { 0, 2, 1, 0, 3, 2, 4, 5, 6, 4, 6, 7, 0, 1, 5, 0, 5, 4,
+                                          3, 6, 2, 3, 7, 6, 0, 4, 7, 0, 7, 3, 1, 2, 6, 1, 6, 5 };
+        glGenVertexArrays(1, &boxVAO);
+        glGenBuffers(1, &boxVBO);
+        glGenBuffers(1, &boxEBO);
+        glBindVertexArray(boxVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, boxVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, boxEBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+        glBindVertexArray(0);
+    }
+
+    void destroy()
+    {
+        for (QuerySet& set : sets)
+        {
+            if (!set.queries.empty())
+                glDeleteQueries((GLsizei)set.queries.size(), set.queries.data());
+            set = QuerySet();
+        }
+        glDeleteVertexArrays(1, &boxVAO);
+        glDeleteBuffers(1, &boxVBO);
+        glDeleteBuffers(1, &boxEBO);
+        glDeleteProgram(program.id);
+        boxVAO = boxVBO = boxEBO = 0;
+    }
+
+    const OcclusionStats& stats() const { return frameStats; }
+
+    // Picks up whatever results of the previous frame's queries are ready
+    void beginFrame(size_t objectCount)
+    {
+        frameStats = OcclusionStats();
+        objectHiddenFlags.assign(objectCount, 0);
+        objectPending.assign(objectCount, 0);
+        hiddenCells.clear();
+
+        QuerySet& previous = sets[(frame + kOcclusionFrames - 1) % kOcclusionFrames];
+        for (size_t i = 0; i < previous.used; ++i)
+        {
+            GLuint query = previous.queries[i];
+            GLuint available = 0;
+            glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+            const QueryTarget& target = previous.targets[i];
+            if (!available)
+            {
+                // Cells have no draw of their own to make conditional, so they just stay visible
+                if (!target.isCell && target.id < objectCount)
+                {
+                    objectPending[target.id] = query;
+                    ++frameStats.pendingResults;
+                }
+                continue;
+            }
+            GLuint samples = 0;
+            glGetQueryObjectuiv(query, GL_QUERY_RESULT, &samples);
+            if (samples)
+                continue;
+            if (target.isCell)
+            {
+                hiddenCells.insert(target.id);
+                ++frameStats.cellsOccluded;
+            }
+            else if (target.id < objectCount)
+            {
+                objectHiddenFlags[target.id] = 1;
+                ++frameStats.objectsOccluded;
+            }
+        }
+    }
+
+    bool objectHidden(int object) const { return objectHiddenFlags[object] != 0; }
+
+    // Query still in flight for an object, to draw it conditionally; 0 when there is none
+    GLuint pendingQuery(int object) const { return objectPending[object]; }
+
+    bool cellHidden(const glm::vec3& position) const
+    {
+        return !hiddenCells.empty() && hiddenCells.count(cellKey(position)) != 0;
+    }
+
+    bool anyCellHidden() const { return !hiddenCells.empty(); }
+
+    // Tests the boxes of the given objects and of the grid cells holding bodies against
+    // the depth buffer, once per frame after the frame's depth is complete. Results are
+    // picked up by the next beginFrame().
+    void issueQueries(const std::vector<int>& objects, const std::vector<AABB>& bounds, const BodyArrays& bodies,
+                      float bodyRadius, const Frustum& frustum, const glm::vec3& viewPos)
+    {
+        QuerySet& set = sets[frame % kOcclusionFrames];
+        set.used = 0;
+        set.targets.clear();
+
+        glUseProgram(program.id);
+        glBindVertexArray(boxVAO);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthMask(GL_FALSE);
+        glDepthFunc(GL_LEQUAL);
+
+        for (int object : objects)
+            queryBox(set, bounds[object], QueryTarget{ (uint64_t)object, false }, viewPos);
+
+        // One box per occupied cell, grown by the largest body radius
+        cellKeys.clear();
+        for (size_t i = 0; i < bodies.x.size(); ++i)
+            cellKeys.push_back(cellKey(glm::vec3(bodies.x[i], bodies.y[i], bodies.z[i])));
+        std::sort(cellKeys.begin(), cellKeys.end());
+        cellKeys.erase(std::unique(cellKeys.begin(), cellKeys.end()), cellKeys.end());
+        for (uint64_t key : cellKeys)
+        {
+            AABB box = cellBounds(key);
+            box.min -= glm::vec3(bodyRadius);
+            box.max += glm::vec3(bodyRadius);
+            if (testBounds(frustum, box) != CullOutside)
+                queryBox(set, box, QueryTarget{ key, true }, viewPos);
+        }
+
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glBindVertexArray(0);
+        frameStats.queries = (int)set.used;
+    }
+
+    void endFrame() { ++frame; }
+
+private:
+    struct QueryTarget
+    {
+        uint64_t id;    // object index or cell key
+        bool isCell;
+    };
+
+    struct QuerySet
+    {
+        std::vector<GLuint> queries;
+        std::vector<QueryTarget> targets;
+        size_t used = 0;
+    };
+
+    // Cells are keyed by their integer coordinates, 21 bits each
+    static uint64_t cellKey(const glm::vec3& position)
+    {
+        auto axis = [](float value) { return (uint64_t)((int64_t)std::floor(value / kOcclusionCellSize) + (1 << 20)) & 0x1FFFFF; };
+        return axis(position.x) | axis(position.y) << 21 | axis(position.z) << 42;
+    }
+
+    static AABB cellBounds(uint64_t key)
+    {
+        auto axis = [&](int shift) { return (float)((int64_t)((key >> shift) & 0x1FFFFF) - (1 << 20)) * kOcclusionCellSize; };
+        glm::vec3 min(axis(0), axis(21), axis(42));
+        return AABB{ min, min + glm::vec3(kOcclusionCellSize) };
+    }
+
+    void queryBox(QuerySet& set, const AABB& box, const QueryTarget& target, const glm::vec3& viewPos)
+    {
+        // The near plane would clip a box around the eye and report it hidden
+        glm::vec3 nearMin = box.min - glm::vec3(kOcclusionCameraMargin);
+        glm::vec3 nearMax = box.max + glm::vec3(kOcclusionCameraMargin);
+        if (viewPos.x >= nearMin.x && viewPos.y >= nearMin.y && viewPos.z >= nearMin.z && viewPos.x <= nearMax.x &&
+            viewPos.y <= nearMax.y && viewPos.z <= nearMax.z)
+            return;
+
+        if (set.used == set.queries.size())
+        {
+            size_t grow = std::max<size_t>(64, set.queries.size());
+            set.queries.resize(set.queries.size() + grow);
+            glGenQueries((GLsizei)grow, set.queries.data() + set.used);
+        }
+        glUniform3fv(boxMinLocation, 1, &box.min.x);
+        glUniform3fv(boxMaxLocation, 1, &box.max.x);
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, set.queries[set.used]);
+        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, (void*)0);
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+        set.targets.push_back(target);
+        ++set.used;
+    }
+
+    ShaderProgram program;
+    GLint boxMinLocation = -1;
+    GLint boxMaxLocation = -1;
+    GLuint boxVAO = 0, boxVBO = 0, boxEBO = 0;
+
+    QuerySet sets[kOcclusionFrames];
+    uint64_t frame = 0;
+    std::vector<unsigned char> objectHiddenFlags;
+    std::vector<GLuint> objectPending;
+    std::unordered_set<uint64_t> hiddenCells;
+    std::vector<uint64_t> cellKeys;
+    OcclusionStats frameStats;
+};
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "shader.h"
+
+// Depth pre-pass and overdraw measurement.
+//
+// Each shading program gets two variants linked from the same vertex shader: a
+// depth-only one with an empty fragment shader, and a counting one whose fragments
+// add 1/255 to the red channel. With a pre-pass the scene is first drawn with the
+// depth-only variants, then shaded with GL_EQUAL and depth writes off, so only the
+// nearest surface of each pixel runs the lighting shader. The vertex shaders declare
+// gl_Position invariant, so both passes produce the same depth.
+//
+// In overdraw mode the counting variants replace the shading programs and draw with
+// additive blending into an RGBA8 target of an OverdrawCounter. The red channel then
+// holds the number of fragments shaded per pixel (exact up to 255), which is read back
+// for the statistics and shown as a heat map.
+
+const char* const kDepthOnlyFragmentSource = R"(
+void main() {
+}
+)";
+
+const char* const kOverdrawFragmentSource = R"(
+out vec4 FragColor;
+
+void main() {
+    FragColor = vec4(1.0 / 255.0, 0.0, 0.0, 0.0);
+}
+)";
+
+// Full-screen triangle colouring each pixel by its fragment count: black for none,
+// then blue, green, yellow and red at 1, 2, 4 and 8 or more.
+const char* const kOverdrawHeatmapVertexSource = R"(#version 330 core
+void main() {
+    vec2 corner = vec2(gl_VertexID == 1 ? 3.0 : -1.0, gl_VertexID == 2 ? 3.0 : -1.0);
+    gl_Position = vec4(corner, 0.0, 1.0);
+}
+)";
+
+const char* const kOverdrawHeatmapFragmentSource = R"(#version 330 core
+uniform sampler2D counts;
+out vec4 FragColor;
+
+void main() {
+    float count = texelFetch(counts, ivec2(gl_FragCoord.xy), 0).r * 255.0;
+    vec3 color = vec3(0.0);
+    if (count >= 0.5)
+    {
+        float level = clamp(log2(count), 0.0, 3.0);
+        vec3 ramp[4] = vec3[4](vec3(0.1, 0.2, 1.0), vec3(0.1, 0.9, 0.2), vec3(1.0, 0.9, 0.1), vec3(1.0, 0.1, 0.1));
+        int index = min(int(level), 2);
+        color = mix(ramp[index], ramp[index + 1], level - float(index));
+    }
+    FragColor = vec4(color, 1.0);
+}
+)";
+
+// Depth-only and counting variants of one shading program
+struct PassPrograms
+{
+    ShaderProgram depth;
+    ShaderProgram count;
+};
+
+inline PassPrograms createPassPrograms(const char* vertexSource, const char* header, const char* uniformBlock,
+                                       GLuint blockBinding, ProgramCache* cache = nullptr)
+{
+    PassPrograms programs;
+    programs.depth = createShaderProgram(vertexSource, kDepthOnlyFragmentSource, header, cache);
+    programs.count = createShaderProgram(vertexSource, kOverdrawFragmentSource, header, cache);
+    bindUniformBlock(programs.depth, uniformBlock, blockBinding);
+    bindUniformBlock(programs.count, uniformBlock, blockBinding);
+    return programs;
+}
+
+inline void destroyPassPrograms(PassPrograms& programs)
+{
+    glDeleteProgram(programs.depth.id);
+    glDeleteProgram(programs.count.id);
+    programs = PassPrograms();
+}
+
+struct OverdrawStats
+{
+    int64_t fragments = 0;     // shaded fragments over the whole frame
+    int pixels = 0;
+    int coveredPixels = 0;     // pixels with at least one fragment
+    int maxPerPixel = 0;
+
+    // Average fragments shaded per covered pixel; 1.0 means no overdraw at all
+    double perCoveredPixel() const { return coveredPixels ? (double)fragments / coveredPixels : 0.0; }
+};
+
+struct OverdrawCounter
+{
+    GLuint fbo = 0;
+    GLuint countTexture = 0;
+    GLuint depthBuffer = 0;
+    int width = 0;
+    int height = 0;
+    ShaderProgram heatmap;
+    GLuint emptyVAO = 0;
+    std::vector<unsigned char> readback;
+};
+
+inline OverdrawCounter createOverdrawCounter(int width, int height, ProgramCache* cache = nullptr)
+{
+    OverdrawCounter counter;
+    counter.width = width;
+    counter.height = height;
+
+    glGenTextures(1, &counter.countTexture);
+    glBindTexture(GL_TEXTURE_2D, counter.countTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenRenderbuffers(1, &counter.depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, counter.depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &counter.fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, counter.fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, counter.countTexture, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, counter.depthBuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    counter.heatmap = createShaderProgram(kOverdrawHeatmapVertexSource, kOverdrawHeatmapFragmentSource, nullptr, cache);
+    glUseProgram(counter.heatmap.id);
+    glUniform1i(counter.heatmap.location("counts"), 0);
+    glUseProgram(0);
+    glGenVertexArrays(1, &counter.emptyVAO);
+    return counter;
+}
+
+// Binds and clears the counting target and switches to additive blending
+inline void beginOverdrawCount(const OverdrawCounter& counter)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, counter.fbo);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+}
+
+// Ends blending and reads back the counts of the width x height corner that was drawn
+// (all of it unless the resolution is scaled). The read waits for the GPU, which is
+// acceptable in a measurement mode.
+inline void endOverdrawCount(OverdrawCounter& counter, OverdrawStats& stats, int width, int height)
+{
+    glDisable(GL_BLEND);
+    counter.readback.resize((size_t)width * height);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RED, GL_UNSIGNED_BYTE, counter.readback.data());
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+    stats = OverdrawStats();
+    stats.pixels = width * height;
+    for (unsigned char count : counter.readback)
+    {
+        stats.fragments += count;
+        stats.coveredPixels += count != 0;
+        stats.maxPerPixel = std::max(stats.maxPerPixel, (int)count);
+    }
+}
+
+// Draws the heat map into the currently bound framebuffer
+inline void drawOverdrawHeatmap(const OverdrawCounter& counter)
+{
+    glDisable(GL_DEPTH_TEST);
+    glUseProgram(counter.heatmap.id);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, counter.countTexture);
+    glBindVertexArray(counter.emptyVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glEnable(GL_DEPTH_TEST);
+}
+
+inline void destroyOverdrawCounter(OverdrawCounter& counter)
+{
+    glDeleteFramebuffers(1, &counter.fbo);
+    glDeleteTextures(1, &counter.countTexture);
+    glDeleteRenderbuffers(1, &counter.depthBuffer);
+    glDeleteVertexArrays(1, &counter.emptyVAO);
+    glDeleteProgram(counter.heatmap.id);
+    counter = OverdrawCounter();
+}
@@ -0,0 +1,376 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Scoped CPU/GPU profiler, cheap enough to leave on.
+//
+// CPU: a ProfileZone records its start and end time into a buffer owned by the
+// calling thread. Each buffer is a single-producer ring: the owning thread appends
+// without locking and the GL thread drains every buffer in Profiler::endFrame().
+// Zone names must be string literals (only the pointer is stored).
+//
+// GPU: a GpuProfileZone brackets GL commands with two GL_TIMESTAMP queries. The
+// results are read kProfilerLatency frames later, when the GPU has long finished
+// with them. Timestamps rather than GL_TIME_ELAPSED because elapsed-time queries
+// cannot nest and the bench recorder already has one open around the whole frame.
+//
+// Every kProfilerWindow frames the per-zone totals become windowAverages(), and
+// runAverages() covers everything since resetRun(). With tracing on, every event is
+// also kept for writeChromeTrace(), which writes Chrome's trace_event JSON
+// (chrome://tracing, Perfetto).
+
+const int kProfilerLatency = 4;
+const int kProfilerWindow = 60;
+const size_t kProfileBufferEvents = 1 << 14;    // per thread, between two drains
+
+struct ProfileEvent
+{
+    const char* name;
+    int64_t startNs;
+    int64_t endNs;
+};
+
+struct ProfileThreadBuffer
+{
+    int threadId = 0;
+    ProfileEvent events[kProfileBufferEvents];
+    std::atomic<uint64_t> written{0};     // advanced by the owning thread
+    std::atomic<uint64_t> drained{0};     // advanced by the GL thread
+    std::atomic<uint64_t> dropped{0};
+};
+
+// Average per frame over the last window
+struct ZoneAverage
+{
+    std::string name;
+    double cpuMs = 0.0;    // summed over threads
+    double gpuMs = 0.0;
+    double calls = 0.0;
+};
+
+struct TraceEvent
+{
+    const char* name;
+    int threadId;          // kGpuTraceThread for GPU zones
+    int64_t startNs;
+    int64_t durationNs;
+};
+
+const int kGpuTraceThread = 1000;
+
+class Profiler
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    std::atomic<bool> enabled{true};
+    bool tracing = false;
+
+    int64_t now() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - epoch).count();
+    }
+
+    // The calling thread's event buffer, registered on first use
+    ProfileThreadBuffer& threadBuffer()
+    {
+        thread_local ProfileThreadBuffer* buffer = nullptr;
+        if (!buffer)
+        {
+            std::lock_guard<std::mutex> lock(threadsMutex);
+            threads.emplace_back(new ProfileThreadBuffer());
+            buffer = threads.back().get();
+            buffer->threadId = (int)threads.size() - 1;
+        }
+        return *buffer;
+    }
+
+    void record(const char* name, int64_t startNs, int64_t endNs)
+    {
+        ProfileThreadBuffer& buffer = threadBuffer();
+        uint64_t index = buffer.written.load(std::memory_order_relaxed);
+        if (index - buffer.drained.load(std::memory_order_acquire) >= kProfileBufferEvents)
+        {
+            buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        buffer.events[index % kProfileBufferEvents] = { name, startNs, endNs };
+        buffer.written.store(index + 1, std::memory_order_release);
+    }
+
+    // GL side, called on the GL thread; the GPU timers need ARB_timer_query
+    void initGpu()
+    {
+        mainThread = threadBuffer().threadId;
+        gpuTimers = GLEW_ARB_timer_query;
+        if (!gpuTimers)
+            return;
+        GLint64 gpuNow = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+        gpuOffsetNs = now() - gpuNow;
+    }
+
+    int beginGpuZone(const char* name)
+    {
+        if (!gpuTimers || !enabled.load(std::memory_order_relaxed))
+            return -1;
+        GpuFrame& frame = gpuFrames[frameIndex % kProfilerLatency];
+        int zone = frame.used++;
+        if (zone == (int)frame.names.size())
+        {
+            frame.names.push_back(nullptr);
+            frame.queries.resize(frame.queries.size() + 2);
+            glGenQueries(2, &frame.queries[zone * 2]);
+        }
+        frame.names[zone] = name;
+        glQueryCounter(frame.queries[zone * 2], GL_TIMESTAMP);
+        return zone;
+    }
+
+    void endGpuZone(int zone)
+    {
+        if (zone < 0)
+            return;
+        glQueryCounter(gpuFrames[frameIndex % kProfilerLatency].queries[zone * 2 + 1], GL_TIMESTAMP);
+    }
+
+    // Reads back the GPU zones issued kProfilerLatency frames ago, freeing their slot
+    void beginFrame()
+    {
+        collectGpuFrame(gpuFrames[frameIndex % kProfilerLatency]);
+    }
+
+    // Drains the CPU buffers into the window totals (and the trace)
+    void endFrame()
+    {
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        for (std::unique_ptr<ProfileThreadBuffer>& buffer : threads)
+        {
+            uint64_t begin = buffer->drained.load(std::memory_order_relaxed);
+            uint64_t end = buffer->written.load(std::memory_order_acquire);
+            for (uint64_t i = begin; i < end; ++i)
+            {
+                const ProfileEvent& event = buffer->events[i % kProfileBufferEvents];
+                ZoneTotals& totals = zoneTotals(event.name);
+                totals.window.cpuNs += event.endNs - event.startNs;
+                totals.run.cpuNs += event.endNs - event.startNs;
+                ++totals.window.calls;
+                ++totals.run.calls;
+                if (tracing)
+                    trace.push_back({ event.name, buffer->threadId, event.startNs, event.endNs - event.startNs });
+            }
+            buffer->drained.store(end, std::memory_order_release);
+        }
+
+        ++frameIndex;
+        ++runFrames;
+        if (++windowFrames == kProfilerWindow)
+        {
+            averages = computeAverages(&ZoneTotals::window, windowFrames);
+            for (auto& entry : totalsByName)
+                entry.second.window = Totals();
+            windowFrames = 0;
+        }
+    }
+
+    // Starts the run averages afresh, e.g. after warmup frames
+    void resetRun()
+    {
+        for (auto& entry : totalsByName)
+            entry.second.run = Totals();
+        runFrames = 0;
+    }
+
+    // Reads the outstanding GPU zones; call once rendering is done
+    void finish()
+    {
+        for (GpuFrame& frame : gpuFrames)
+            collectGpuFrame(frame);
+    }
+
+    const std::vector<ZoneAverage>& windowAverages() const { return averages; }
+    std::vector<ZoneAverage> runAverages() { return computeAverages(&ZoneTotals::run, runFrames); }
+
+    size_t droppedEvents()
+    {
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        size_t dropped = 0;
+        for (std::unique_ptr<ProfileThreadBuffer>& buffer : threads)
+            dropped += buffer->dropped.load(std::memory_order_relaxed);
+        return dropped;
+    }
+
+    bool writeChromeTrace(const std::string& path)
+    {
+        std::ofstream out(path);
+        if (!out)
+            return false;
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        {
+            std::lock_guard<std::mutex> lock(threadsMutex);
+            for (size_t i = 0; i < threads.size(); ++i)
+                out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << i << ", \"args\": {\"name\": \""
+                    << ((int)i == mainThread ? std::string("main") : "worker " + std::to_string(i)) << "\"}},\n";
+        }
+        out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << kGpuTraceThread
+            << ", \"args\": {\"name\": \"GPU\"}}";
+        // Microseconds, as the format expects
+        for (const TraceEvent& event : trace)
+            out << ",\n{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << event.threadId
+                << ", \"ts\": " << event.startNs / 1000.0 << ", \"dur\": " << event.durationNs / 1000.0 << "}";
+        out << "\n]}\n";
+        return true;
+    }
+
+private:
+    struct Totals
+    {
+        int64_t cpuNs = 0;
+        int64_t gpuNs = 0;
+        int64_t calls = 0;
+    };
+
+    struct ZoneTotals
+    {
+        Totals window;
+        Totals run;
+    };
+
+    // Queries are kept per frame slot and reused once read back
+    struct GpuFrame
+    {
+        std::vector<GLuint> queries;    // start and end per zone
+        std::vector<const char*> names;
+        int used = 0;
+    };
+
+    ZoneTotals& zoneTotals(const char* name)
+    {
+        auto found = totalsByName.find(name);
+        if (found != totalsByName.end())
+            return found->second;
+        zoneOrder.push_back(name);
+        return totalsByName[name];
+    }
+
+    std::vector<ZoneAverage> computeAverages(Totals ZoneTotals::*field, int frames)
+    {
+        std::vector<ZoneAverage> result;
+        for (const std::string& name : zoneOrder)
+        {
+            const Totals& totals = totalsByName[name].*field;
+            ZoneAverage average;
+            average.name = name;
+            average.cpuMs = frames > 0 ? totals.cpuNs / 1.0e6 / frames : 0.0;
+            average.gpuMs = frames > 0 ? totals.gpuNs / 1.0e6 / frames : 0.0;
+            average.calls = frames > 0 ? (double)totals.calls / frames : 0.0;
+            result.push_back(average);
+        }
+        return result;
+    }
+
+    void collectGpuFrame(GpuFrame& frame)
+    {
+        for (int zone = 0; zone < frame.used; ++zone)
+        {
+            GLuint64 start = 0, end = 0;
+            glGetQueryObjectui64v(frame.queries[zone * 2], GL_QUERY_RESULT, &start);
+            glGetQueryObjectui64v(frame.queries[zone * 2 + 1], GL_QUERY_RESULT, &end);
+            ZoneTotals& totals = zoneTotals(frame.names[zone]);
+            totals.window.gpuNs += (int64_t)(end - start);
+            totals.run.gpuNs += (int64_t)(end - start);
+            if (tracing)
+                trace.push_back({ frame.names[zone], kGpuTraceThread, (int64_t)start + gpuOffsetNs, (int64_t)(end - start) });
+        }
+        frame.used = 0;
+    }
+
+    Clock::time_point epoch = Clock::now();
+    std::mutex threadsMutex;
+    std::vector<std::unique_ptr<ProfileThreadBuffer>> threads;
+    int mainThread = 0;
+
+    bool gpuTimers = false;
+    int64_t gpuOffsetNs = 0;    // CPU clock minus GPU clock
+    GpuFrame gpuFrames[kProfilerLatency];
+
+    int frameIndex = 0;
+    int windowFrames = 0;
+    int runFrames = 0;
+    std::unordered_map<std::string, ZoneTotals> totalsByName;
+    std::vector<std::string> zoneOrder;    // first-seen order, for stable summaries
+    std::vector<ZoneAverage> averages;
+    std::vector<TraceEvent> trace;
+};
+
+inline Profiler& profiler()
+{
+    static Profiler instance;
+    return instance;
+}
+
+// Times the enclosing scope on the calling thread
+class ProfileZone
+{
+public:
+    explicit ProfileZone(const char* name) : name(name)
+    {
+        if (profiler().enabled.load(std::memory_order_relaxed))
+            startNs = profiler().now();
+    }
+
+    ~ProfileZone()
+    {
+        if (startNs >= 0)
+            profiler().record(name, startNs, profiler().now());
+    }
+
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+
+private:
+    const char* name;
+    int64_t startNs = -1;
+};
+
+// Times the GL commands issued in the enclosing scope; GL thread only
+class GpuProfileZone
+{
+public:
+    explicit GpuProfileZone(const char* name) : zone(profiler().beginGpuZone(name)) {}
+    ~GpuProfileZone() { profiler().endGpuZone(zone); }
+
+    GpuProfileZone(const GpuProfileZone&) = delete;
+    GpuProfileZone& operator=(const GpuProfileZone&) = delete;
+
+private:
+    int zone;
+};
+
+// "name 1.23 ms" per zone, or "name 1.23/4.56 gpu ms" for zones also timed on the GPU
+inline std::string profilerSummary(const std::vector<ZoneAverage>& averages, const char* separator = " | ")
+{
+    std::ostringstream out;
+    out.setf(std::ios::fixed);
+    out.precision(2);
+    for (size_t i = 0; i < averages.size(); ++i)
+    {
+        const ZoneAverage& zone = averages[i];
+        out << (i ? separator : "") << zone.name << ' ' << zone.cpuMs;
+        if (zone.gpuMs > 0.0)
+            out << "/" << zone.gpuMs << " gpu";
+        out << " ms";
+    }
+    return out.str();
+}
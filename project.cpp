@@ -8,78 +8,132 @@
 #include <fstream>
 #include <sstream>
 #include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb/stb_image.h>
 
+#include "headless.h"
+#include "bench.h"
+#include "shader.h"
+#include "bodies.h"
+#include "scene.h"
+#include "animation.h"
+#include "culling.h"
+#include "geometry.h"
+#include "textures.h"
+#include "lighting.h"
+#include "renderqueue.h"
+#include "streambuffer.h"
+#include "profiler.h"
+#include "simthread.h"
+#include "scenejson.h"
+#include "overdraw.h"
+#include "occlusion.h"
+#include "resolution.h"
+#include "inputlog.h"
+#include "regression.h"
+
 // Shaders
+// Shared by every program: version line and the per-frame uniform block
+const char* shaderHeader = R"(#version 330 core
+layout(std140) uniform FrameData
+{
+    mat4 viewMatrix;
+    mat4 projectionMatrix;
+    vec4 viewPos;
+    vec4 ambientColor;
+    vec4 clusterScale;    // tile width and height in pixels, log-depth slice scale and bias
+    ivec4 clusterDims;
+};
+
+// Per-cluster light lists built by updateLightClusters() (lighting.h)
+uniform samplerBuffer lightData;
+uniform usamplerBuffer clusterRanges;
+uniform usamplerBuffer clusterIndices;
+
+// Phong lighting from the point lights binned into the fragment's cluster.
+// fragCoord is gl_FragCoord.xy.
+vec3 computeLighting(vec3 fragPos, vec3 norm, vec2 fragCoord)
+{
+    float depth = -(viewMatrix * vec4(fragPos, 1.0)).z;
+    ivec3 cell = ivec3(fragCoord / clusterScale.xy, log(max(depth, 1e-4)) * clusterScale.z + clusterScale.w);
+    cell = clamp(cell, ivec3(0), clusterDims.xyz - 1);
+    uvec2 range = texelFetch(clusterRanges, (cell.z * clusterDims.y + cell.y) * clusterDims.x + cell.x).xy;
+
+    float specularStrength = 0.2;
+    vec3 viewDir = normalize(viewPos.xyz - fragPos);
+    vec3 result = ambientColor.rgb;
+    for (uint i = 0u; i < range.y; ++i)
+    {
+        int light = int(texelFetch(clusterIndices, int(range.x + i)).x);
+        vec4 positionRadius = texelFetch(lightData, light * 2);
+        vec3 lightColor = texelFetch(lightData, light * 2 + 1).rgb;
+
+        // Windowed falloff, reaching zero at the light's radius
+        vec3 toLight = positionRadius.xyz - fragPos;
+        float distance = length(toLight);
+        float ratio = distance / positionRadius.w;
+        float falloff = clamp(1.0 - ratio * ratio * ratio * ratio, 0.0, 1.0);
+        falloff *= falloff;
+
+        vec3 lightDir = toLight / max(distance, 1e-4);
+        float diff = max(dot(norm, lightDir), 0.0);
+        vec3 reflectDir = reflect(-lightDir, norm);
+        float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32.0);
+        result += falloff * (diff + specularStrength * spec) * lightColor;
+    }
+    return result;
+}
+
+// Unit normal from the octahedral encoding used by PackedVertex
+vec3 decodeNormal(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+)";
+
 const char* vertexShaderSource = R"(
-#version 330 core
 layout(location = 0) in vec3 aPos;
-layout(location = 1) in vec3 aNormal;
+layout(location = 1) in vec2 aNormal;
 layout(location = 2) in vec2 aTexCoord;
-
-uniform mat4 worldMatrix;
-uniform mat4 viewMatrix;
-uniform mat4 projectionMatrix;
+layout(location = 3) in mat4 aWorldMatrix;
+layout(location = 7) in vec4 aColor;
 
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoord;
+flat out vec3 Color;
+invariant gl_Position;
 
 void main() {
-    FragPos = vec3(worldMatrix * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(worldMatrix))) * aNormal;
+    FragPos = vec3(aWorldMatrix * vec4(aPos, 1.0));
+    Normal = mat3(transpose(inverse(aWorldMatrix))) * decodeNormal(aNormal);
     TexCoord = aTexCoord;
+    Color = aColor.rgb;
     gl_Position = projectionMatrix * viewMatrix * vec4(FragPos, 1.0);
 })";
 
 const char* fragmentShaderSource = R"(
-#version 330 core
 in vec3 FragPos;
 in vec3 Normal;
 in vec2 TexCoord;
+flat in vec3 Color;
 
 out vec4 FragColor;
 
+// Untextured objects are drawn with a white texture and their colour
 uniform sampler2D texture1;
-uniform bool useTexture;
-
-uniform vec3 lightPos;
-uniform vec3 viewPos;
-uniform vec3 lightColor;
-uniform vec3 lightPos2;
-uniform vec3 lightColor2;
-uniform vec3 objectColor;
 
 void main() {
-    // Ambient
-    float ambientStrength = 0.2;
-    vec3 ambient = ambientStrength * lightColor;
-
-    // Diffuse
-    vec3 norm = normalize(Normal);
-    vec3 lightDir = normalize(lightPos - FragPos);
-    float diff = max(dot(norm, lightDir), 0.0);
-    vec3 diffuse = diff * lightColor;
-
-    // Specular
-    float specularStrength = 0.2;
-    vec3 viewDir = normalize(viewPos - FragPos);
-    vec3 reflectDir = reflect(-lightDir, norm);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32.0);
-    vec3 specular = specularStrength * spec * lightColor;
-
-    vec3 lightDir2 = normalize(lightPos2 - FragPos);
-    float diff2 = max(dot(norm, lightDir2), 0.0);
-    vec3 diffuse2 = diff2 * lightColor2;
+    vec3 lighting = computeLighting(FragPos, normalize(Normal), gl_FragCoord.xy);
 
-    vec3 reflectDir2 = reflect(-lightDir2, norm);
-    float spec2 = pow(max(dot(viewDir, reflectDir2), 0.0), 32.0);
-    vec3 specular2 = specularStrength * spec2 * lightColor2;
-
-    vec3 lighting = (ambient + diffuse + specular + diffuse2 + specular2);
-
-    vec3 baseColor = useTexture ? texture(texture1, TexCoord).rgb : objectColor;
+    vec3 baseColor = texture(texture1, TexCoord).rgb * Color;
 
     vec3 result = lighting * baseColor;
     FragColor = vec4(result, 1.0);
@@ -100,221 +154,267 @@ glm::vec3 cameraUp = glm::vec3(0.0f, 1.0f, 0.0f);
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 
-// Shader compilation
-GLuint compileShader(GLenum type, const char* source)
-{
-    GLuint shader = glCreateShader(type);
-    glShaderSource(shader, 1, &source, nullptr);
-    glCompileShader(shader);
-
-    GLint success;
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        char infoLog[512];
-        glGetShaderInfoLog(shader, 512, nullptr, infoLog);
-        std::cerr << "Shader compilation error:\n" << infoLog << std::endl;
-    }
-    return shader;
-}
-
-GLuint createShaderProgram()
+// Command line options
+int windowWidth = 1200;
+int windowHeight = 700;
+bool benchMode = false;
+int benchFrames = 600;
+int benchWarmup = 30;
+bool benchWarmupGiven = false;
+float benchTimestep = 1.0f / 60.0f;
+std::string benchOutput = "bench";
+int bodyCount = 0;
+bool gravityMode = false;
+int threadCount = 0;
+bool compressTextures = true;
+std::string shaderCacheDirectory = "shader_cache";
+std::string scenePath = "room.json";
+int lightCount = -1;
+float tickRate = 60.0f;
+bool profilerEnabled = true;
+std::string tracePath;
+bool showProfile = false;
+int prepassOption = -1;    // -1: as the scene file says
+bool overdrawMode = false;
+bool occlusionCulling = false;
+float resolutionScale = 0.0f;          // fixed render scale, 0 to let the controller pick
+int dynamicResolutionOption = -1;      // -1: on in a window, off in --bench
+float frameBudgetMs = 16.7f;
+float minResolutionScale = 0.5f;
+float upscaleSharpness = 0.25f;
+bool framebufferResized = false;
+std::string recordPath;
+std::string replayPath;
+std::vector<int> dumpFrames;
+std::string dumpDirectory = "frames";
+std::string goldenDirectory;
+int pixelTolerance = 2;
+float maxDifferingPixels = 0.001f;    // fraction of a frame
+std::string baselinePath;
+float maxRegressionPercent = 10.0f;
+InputLogWriter inputRecording;
+
+const char* windowTitle = "Parallelepiped Scene with Textured Spheres";
+
+void printUsage(const char* program)
 {
-    GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexShaderSource);
-    GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentShaderSource);
-
-    GLuint program = glCreateProgram();
-    glAttachShader(program, vertexShader);
-    glAttachShader(program, fragmentShader);
-    glLinkProgram(program);
-
-    GLint success;
-    glGetProgramiv(program, GL_LINK_STATUS, &success);
-    if (!success)
-    {
-        char infoLog[512];
-        glGetProgramInfoLog(program, 512, nullptr, infoLog);
-        std::cerr << "Program linking error:\n" << infoLog << std::endl;
-    }
-
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
-
-    return program;
+    std::cout << "Usage: " << program << " [options]\n"
+              << "  --bench            Render offscreen with a fixed timestep and report frame timings\n"
+              << "  --frames N         Number of frames to render in --bench mode (default 600)\n"
+              << "  --warmup N         Frames excluded from the statistics (default 30, a tenth of a replay)\n"
+              << "  --timestep S       Simulated seconds per frame in --bench mode (default 1/60)\n"
+              << "  --size WxH         Framebuffer size (default 1200x700)\n"
+              << "  --bench-out PATH   Output prefix for PATH.csv and PATH.json (default bench)\n"
+              << "  --scene PATH       Scene to load: a .json description or a converted .scene file (default room.json)\n"
+              << "  --bodies N         Add an instanced belt of N orbiting bodies (default 0)\n"
+              << "  --lights N         Point lights carried by belt bodies (default: one per body)\n"
+              << "  --tick-rate HZ     Simulation ticks per second outside --bench (default 60)\n"
+              << "  --gravity          Simulate the belt with Barnes-Hut N-body gravity instead of Kepler orbits\n"
+              << "  --threads N        Worker threads for simulation and texture loading (default: all cores)\n"
+              << "  --no-texture-compression  Cook opaque textures as RGB8 instead of BC1\n"
+              << "  --shader-cache DIR Directory for cached program binaries (default shader_cache)\n"
+              << "  --no-shader-cache  Always compile and link shaders\n"
+              << "  --prepass          Draw a depth-only pre-pass, then shade with GL_EQUAL (default: per scene file)\n"
+              << "  --no-prepass       Never draw the depth pre-pass\n"
+              << "  --overdraw         Count shaded fragments per pixel and show them as a heat map (O toggles)\n"
+              << "  --occlusion        Skip objects and belt cells whose bounding boxes were hidden last frame\n"
+              << "  --resolution-scale S  Render at a fixed fraction S of the output size and upscale (turns off the controller)\n"
+              << "  --target-ms MS     Frame-time budget of dynamic resolution (default 16.7; also turns it on in --bench)\n"
+              << "  --min-scale S      Lowest scale dynamic resolution may pick (default 0.5)\n"
+              << "  --no-dynamic-resolution  Always render at the output size\n"
+              << "  --sharpen X        Sharpening of the upscale pass, 0 for plain bilinear (default 0.25)\n"
+              << "  --record PATH      Record the camera input and timing of a windowed run to PATH\n"
+              << "  --replay PATH      Replay a recorded run headlessly with its options (implies --bench)\n"
+              << "  --dump-frames LIST Write the listed frames (e.g. 0,100,250) as PPM images\n"
+              << "  --dump-dir DIR     Directory for --dump-frames (default frames)\n"
+              << "  --golden DIR       Compare the dumped frames with DIR's and fail if they differ\n"
+              << "  --pixel-tolerance N  Channel difference --golden ignores (default 2)\n"
+              << "  --max-diff-pixels F  Fraction of a frame's pixels allowed to differ (default 0.001)\n"
+              << "  --baseline PATH    Fail if the frame-time p95 regressed against this bench.json\n"
+              << "  --max-regression PCT  Allowed p95 growth over --baseline (default 10)\n"
+              << "  --trace PATH       Write a Chrome trace (chrome://tracing) of every profiler zone to PATH\n"
+              << "  --no-profiler      Disable the CPU/GPU zone profiler (P toggles its summary in the title)\n";
 }
 
-// Cube vertices
-float cubeVertices[] = {
-    // Position          // Normals           // Texture coordinates
-    -0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f, 0.0f,
-     0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f, 0.0f,
-     0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f, 1.0f,
-     0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f, 1.0f,
-    -0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f, 1.0f,
-    -0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f, 0.0f,
-
-    -0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  0.0f, 0.0f,
-     0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  1.0f, 0.0f,
-     0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  1.0f, 1.0f,
-     0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  1.0f, 1.0f,
-    -0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  0.0f, 1.0f,
-    -0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  0.0f, 0.0f,
-
-    -0.5f,  0.5f,  0.5f, -1.0f,  0.0f,  0.0f,  1.0f, 0.0f,
-    -0.5f,  0.5f, -0.5f, -1.0f,  0.0f,  0.0f,  1.0f, 1.0f,
-    -0.5f, -0.5f, -0.5f, -1.0f,  0.0f,  0.0f,  0.0f, 1.0f,
-    -0.5f, -0.5f, -0.5f, -1.0f,  0.0f,  0.0f,  0.0f, 1.0f,
-    -0.5f, -0.5f,  0.5f, -1.0f,  0.0f,  0.0f,  0.0f, 0.0f,
-    -0.5f,  0.5f,  0.5f, -1.0f,  0.0f,  0.0f,  1.0f, 0.0f,
-
-     0.5f,  0.5f,  0.5f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f,
-     0.5f,  0.5f, -0.5f,  1.0f,  0.0f,  0.0f,  1.0f, 1.0f,
-     0.5f, -0.5f, -0.5f,  1.0f,  0.0f,  0.0f,  0.0f, 1.0f,
-     0.5f, -0.5f, -0.5f,  1.0f,  0.0f,  0.0f,  0.0f, 1.0f,
-     0.5f, -0.5f,  0.5f,  1.0f,  0.0f,  0.0f,  0.0f, 0.0f,
-     0.5f,  0.5f,  0.5f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f,
-
-    -0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,  0.0f, 1.0f,
-     0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,  1.0f, 1.0f,
-     0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,  1.0f, 0.0f,
-     0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,  1.0f, 0.0f,
-    -0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,  0.0f, 0.0f,
-    -0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,  0.0f, 1.0f,
-
-    -0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,  0.0f, 1.0f,
-     0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,  1.0f, 1.0f,
-     0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,  1.0f, 0.0f,
-     0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,  1.0f, 0.0f,
-    -0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,  0.0f, 0.0f,
-    -0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,  0.0f, 1.0f
-};
-
-// Sphere generation function
-void generateSphere(float radius, int sectors, int stacks, std::vector<float>& vertices, std::vector<unsigned int>& indices)
+bool parseArguments(int argc, char** argv)
 {
-    const float PI = 3.14159265359f;
-    vertices.clear();
-    indices.clear();
-
-    for (int i = 0; i <= stacks; ++i)
+    for (int i = 1; i < argc; ++i)
     {
-        float v = i / (float)stacks;
-        float phi = v * PI;
-
-        for (int j = 0; j <= sectors; ++j)
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--bench")
+            benchMode = true;
+        else if (arg == "--frames" && hasValue)
+            benchFrames = std::max(1, atoi(argv[++i]));
+        else if (arg == "--warmup" && hasValue)
         {
-            float u = j / (float)sectors;
-            float theta = u * 2.0f * PI;
-
-            float x = cos(theta) * sin(phi);
-            float y = cos(phi);
-            float z = sin(theta) * sin(phi);
-
-            // Position
-            vertices.push_back(x * radius);
-            vertices.push_back(y * radius);
-            vertices.push_back(z * radius);
-
-            // Normal (same as position for a unit sphere)
-            vertices.push_back(x);
-            vertices.push_back(y);
-            vertices.push_back(z);
-
-            // Texture coordinates
-            vertices.push_back(u);
-            vertices.push_back(v);
+            benchWarmup = std::max(0, atoi(argv[++i]));
+            benchWarmupGiven = true;
         }
-    }
-
-    for (int i = 0; i < stacks; ++i)
-    {
-        for (int j = 0; j < sectors; ++j)
+        else if (arg == "--timestep" && hasValue)
+            benchTimestep = (float)atof(argv[++i]);
+        else if (arg == "--size" && hasValue)
         {
-            int k1 = i * (sectors + 1) + j;
-            int k2 = k1 + sectors + 1;
-
-            indices.push_back(k1);
-            indices.push_back(k2);
-            indices.push_back(k1 + 1);
-
-            indices.push_back(k1 + 1);
-            indices.push_back(k2);
-            indices.push_back(k2 + 1);
+            if (sscanf(argv[++i], "%dx%d", &windowWidth, &windowHeight) != 2 || windowWidth <= 0 || windowHeight <= 0)
+            {
+                std::cerr << "Invalid --size, expected WxH\n";
+                return false;
+            }
+        }
+        else if (arg == "--bench-out" && hasValue)
+            benchOutput = argv[++i];
+        else if (arg == "--scene" && hasValue)
+            scenePath = argv[++i];
+        else if (arg == "--bodies" && hasValue)
+            bodyCount = std::max(0, atoi(argv[++i]));
+        else if (arg == "--lights" && hasValue)
+            lightCount = std::max(0, atoi(argv[++i]));
+        else if (arg == "--tick-rate" && hasValue)
+            tickRate = std::max(1.0f, (float)atof(argv[++i]));
+        else if (arg == "--gravity")
+            gravityMode = true;
+        else if (arg == "--threads" && hasValue)
+            threadCount = std::max(1, atoi(argv[++i]));
+        else if (arg == "--no-texture-compression")
+            compressTextures = false;
+        else if (arg == "--shader-cache" && hasValue)
+            shaderCacheDirectory = argv[++i];
+        else if (arg == "--no-shader-cache")
+            shaderCacheDirectory.clear();
+        else if (arg == "--trace" && hasValue)
+            tracePath = argv[++i];
+        else if (arg == "--prepass")
+            prepassOption = 1;
+        else if (arg == "--no-prepass")
+            prepassOption = 0;
+        else if (arg == "--overdraw")
+            overdrawMode = true;
+        else if (arg == "--occlusion")
+            occlusionCulling = true;
+        else if (arg == "--resolution-scale" && hasValue)
+            resolutionScale = std::min(std::max((float)atof(argv[++i]), 0.1f), 1.0f);
+        else if (arg == "--target-ms" && hasValue)
+        {
+            frameBudgetMs = std::max(1.0f, (float)atof(argv[++i]));
+            dynamicResolutionOption = 1;
+        }
+        else if (arg == "--min-scale" && hasValue)
+            minResolutionScale = std::min(std::max((float)atof(argv[++i]), 0.1f), 1.0f);
+        else if (arg == "--no-dynamic-resolution")
+            dynamicResolutionOption = 0;
+        else if (arg == "--sharpen" && hasValue)
+            upscaleSharpness = std::max(0.0f, (float)atof(argv[++i]));
+        else if (arg == "--no-profiler")
+            profilerEnabled = false;
+        else if (arg == "--record" && hasValue)
+            recordPath = argv[++i];
+        else if (arg == "--replay" && hasValue)
+            replayPath = argv[++i];
+        else if (arg == "--dump-frames" && hasValue)
+        {
+            if (!parseFrameList(argv[++i], dumpFrames))
+            {
+                std::cerr << "Invalid --dump-frames, expected a list such as 0,100,250\n";
+                return false;
+            }
+        }
+        else if (arg == "--dump-dir" && hasValue)
+            dumpDirectory = argv[++i];
+        else if (arg == "--golden" && hasValue)
+            goldenDirectory = argv[++i];
+        else if (arg == "--pixel-tolerance" && hasValue)
+            pixelTolerance = std::max(0, atoi(argv[++i]));
+        else if (arg == "--max-diff-pixels" && hasValue)
+            maxDifferingPixels = std::max(0.0f, (float)atof(argv[++i]));
+        else if (arg == "--baseline" && hasValue)
+            baselinePath = argv[++i];
+        else if (arg == "--max-regression" && hasValue)
+            maxRegressionPercent = (float)atof(argv[++i]);
+        else
+        {
+            printUsage(argv[0]);
+            return false;
         }
     }
+    return true;
 }
 
-// Function to load a texture
-GLuint loadTexture(const char* filename)
+// Per-frame camera and light state, laid out to match the std140 FrameData block
+struct FrameData
 {
-    int width, height, nrChannels;
-    unsigned char* data = stbi_load(filename, &width, &height, &nrChannels, 0);
-    GLuint texture;
-    glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_2D, texture);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    if (data)
-    {
-        GLenum format = (nrChannels == 4) ? GL_RGBA : GL_RGB;
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-    }
-    else
-    {
-        std::cerr << "Failed to load texture: " << filename << std::endl;
-    }
-    stbi_image_free(data);
-    return texture;
-}
+    glm::mat4 viewMatrix;
+    glm::mat4 projectionMatrix;
+    glm::vec4 viewPos;
+    glm::vec4 ambientColor;
+    glm::vec4 clusterScale;
+    glm::ivec4 clusterDims;
+};
+
+const GLuint kFrameDataBinding = 0;
 
-// Draw function for cubes and spheres
-void drawObject(GLuint shaderProgram, GLuint VAO, const glm::mat4& worldMatrix, const glm::vec3& color, 
-                const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix, GLuint texture = 0, bool isSphere = false, GLuint EBO = 0, int indexCount = 0)
+// Scene shader; per-object data comes from the render queue's instance attributes
+ShaderProgram createSceneShader(ProgramCache* cache)
 {
-    glUseProgram(shaderProgram);
+    ShaderProgram shader = createShaderProgram(vertexShaderSource, fragmentShaderSource, shaderHeader, cache);
+    bindUniformBlock(shader, "FrameData", kFrameDataBinding);
+    bindLightingSamplers(shader);
+
+    // The sampler never changes unit, so set it once here instead of per draw
+    glUseProgram(shader.id);
+    glUniform1i(shader.location("texture1"), 0);
+    glUseProgram(0);
+    return shader;
+}
 
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "worldMatrix"), 1, GL_FALSE, &worldMatrix[0][0]);
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "viewMatrix"), 1, GL_FALSE, &viewMatrix[0][0]);
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projectionMatrix"), 1, GL_FALSE, &projectionMatrix[0][0]);
-    glUniform3fv(glGetUniformLocation(shaderProgram, "objectColor"), 1, &color[0]);
+// A drawable attached to a scene graph node
+struct SceneObject
+{
+    int node;
+    GLuint VAO;
+    int texture;    // TextureManager handle, -1 for none
+    glm::vec3 color;
+    bool isSphere;
+    int lod = -1;    // current sphere LOD, -1 until first selected
+};
 
-    if (texture != 0)
-    {
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, texture);
-        glUniform1i(glGetUniformLocation(shaderProgram, "useTexture"), 1);
-        glUniform1i(glGetUniformLocation(shaderProgram, "texture1"), 0);
-    }
-    else
-    {
-        glUniform1i(glGetUniformLocation(shaderProgram, "useTexture"), 0);
-    }
+// Everything the simulation thread publishes per tick; the renderer blends two of these
+struct SimulationState
+{
+    glm::vec3 lightPos;
+    glm::vec3 lightPos2;
+    std::vector<glm::vec3> orbitPositions;    // one per Orbit
+    BodyArrays bodies;                        // positions only
+};
 
-    glBindVertexArray(VAO);
-    if (isSphere)
-    {
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
-    }
-    else
-    {
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-    }
-    glBindVertexArray(0);
+typedef SimulationThread<SimulationState> SimulationLoop;
 
-    if (texture != 0)
+// Interpolates a snapshot at render time `time` into `out`
+void interpolateState(const SimulationLoop::Snapshot& snapshot, double time, SimulationState& out)
+{
+    float alpha = SimulationLoop::blendFactor(snapshot, time);
+    const SimulationState& a = snapshot.previous;
+    const SimulationState& b = snapshot.current;
+    out.lightPos = glm::mix(a.lightPos, b.lightPos, alpha);
+    out.lightPos2 = glm::mix(a.lightPos2, b.lightPos2, alpha);
+    out.orbitPositions.resize(b.orbitPositions.size());
+    for (size_t i = 0; i < b.orbitPositions.size(); ++i)
+        out.orbitPositions[i] = glm::mix(a.orbitPositions[i], b.orbitPositions[i], alpha);
+
+    size_t count = b.bodies.size();
+    out.bodies.x.resize(count);
+    out.bodies.y.resize(count);
+    out.bodies.z.resize(count);
+    for (size_t i = 0; i < count; ++i)
     {
-        glBindTexture(GL_TEXTURE_2D, 0);
+        out.bodies.x[i] = a.bodies.x[i] + (b.bodies.x[i] - a.bodies.x[i]) * alpha;
+        out.bodies.y[i] = a.bodies.y[i] + (b.bodies.y[i] - a.bodies.y[i]) * alpha;
+        out.bodies.z[i] = a.bodies.z[i] + (b.bodies.z[i] - a.bodies.z[i]) * alpha;
     }
 }
 
 void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 {
+    inputRecording.cursor(xpos, ypos);
     if (firstMouse)
     {
         lastX = xpos;
@@ -327,101 +427,230 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
     lastX = xpos;
     lastY = ypos;
 
-    float sensitivity = 0.1f;
-    xoffset *= sensitivity;
-    yoffset *= sensitivity;
-
-    yaw += xoffset;
-    pitch += yoffset;
+    applyMouseLook(yaw, pitch, xoffset, yoffset);
+    cameraFront = lookDirection(yaw, pitch);
+}
 
-    if (pitch > 89.0f)
-        pitch = 89.0f;
-    if (pitch < -89.0f)
-        pitch = -89.0f;
+// Sizes are picked up at the start of the next frame; a minimized window keeps the old one
+void framebuffer_size_callback(GLFWwindow* window, int width, int height)
+{
+    if (width <= 0 || height <= 0)
+        return;
+    windowWidth = width;
+    windowHeight = height;
+    framebufferResized = true;
+}
 
-    glm::vec3 front;
-    front.x = cos(glm::radians(yaw)) * cos(glm::radians(pitch));
-    front.y = sin(glm::radians(pitch));
-    front.z = sin(glm::radians(yaw)) * cos(glm::radians(pitch));
-    cameraFront = glm::normalize(front);
+// Keys processInput reacts to, as InputKeys bits
+uint8_t readKeys(GLFWwindow* window)
+{
+    const int keys[] = { GLFW_KEY_W, GLFW_KEY_S, GLFW_KEY_A, GLFW_KEY_D, GLFW_KEY_P, GLFW_KEY_O };
+    uint8_t held = 0;
+    for (int i = 0; i < 6; ++i)
+    {
+        if (glfwGetKey(window, keys[i]) == GLFW_PRESS)
+            held |= (uint8_t)(1 << i);
+    }
+    return held;
 }
 
-void processInput(GLFWwindow* window)
+// Takes the keys as bits so a replay can drive it without a window
+void processInput(GLFWwindow* window, uint8_t keys)
 {
     float cameraSpeed = 3.0f * deltaTime;
 
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+    if (keys & InputKeyForward)
         cameraPos += cameraSpeed * cameraFront;
-    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+    if (keys & InputKeyBack)
         cameraPos -= cameraSpeed * cameraFront;
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
+    if (keys & InputKeyLeft)
         cameraPos -= glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;
-    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+    if (keys & InputKeyRight)
         cameraPos += glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;
 
     cameraPos.y = 0.51f;
+
+    // P toggles the profiler summary in the window title
+    static bool profileKeyDown = false;
+    bool profileKey = (keys & InputKeyProfile) != 0;
+    if (profileKey && !profileKeyDown)
+    {
+        showProfile = !showProfile;
+        if (!showProfile && window)
+            glfwSetWindowTitle(window, windowTitle);
+    }
+    profileKeyDown = profileKey;
+
+    // O toggles the overdraw heat map
+    static bool overdrawKeyDown = false;
+    bool overdrawKey = (keys & InputKeyOverdraw) != 0;
+    if (overdrawKey && !overdrawKeyDown)
+    {
+        overdrawMode = !overdrawMode;
+        if (!overdrawMode && !showProfile && window)
+            glfwSetWindowTitle(window, windowTitle);
+    }
+    overdrawKeyDown = overdrawKey;
 }
 
 glm::vec3 lightPos(1.2f, 2.5f, 1.5f);
 glm::vec3 lightPos2 = glm::vec3(25.2f, 2.5f, 25.5f);
 glm::vec3 lightColor2 = glm::vec3(1.0f, 0.0f, 0.0f);
 
-int main()
+// The two room lights reach every wall; belt emitters only light their neighbourhood
+const float kRoomLightRadius = 1000.0f;
+const float kEmitterRadius = 1.2f;
+
+int main(int argc, char** argv)
 {
-    if (!glfwInit())
+    if (!parseArguments(argc, argv))
+        return -1;
+
+    // A replay runs with the options it was recorded with, at its size; anything given
+    // on the command line still wins
+    InputLog replayLog;
+    bool replaying = !replayPath.empty();
+    if (replaying)
+    {
+        std::string error;
+        if (!loadInputLog(replayPath, replayLog, error))
+        {
+            std::cerr << "Failed to load input log " << replayPath << ": " << error << std::endl;
+            return -1;
+        }
+        std::vector<char*> recorded = { argv[0] };
+        for (std::string& argument : replayLog.arguments)
+            recorded.push_back(&argument[0]);
+        if (!parseArguments((int)recorded.size(), recorded.data()))
+            return -1;
+        windowWidth = replayLog.width;
+        windowHeight = replayLog.height;
+        if (!parseArguments(argc, argv))
+            return -1;
+        benchMode = true;
+        benchFrames = (int)replayLog.frames.size();
+        // The default warmup would swallow most of a short recording
+        if (!benchWarmupGiven)
+            benchWarmup = std::min(benchWarmup, benchFrames / 10);
+        recordPath.clear();
+    }
+    if (benchMode && !recordPath.empty())
     {
-        std::cerr << "Failed to init GLFW\n";
+        std::cerr << "--record needs a window, it cannot be combined with --bench\n";
         return -1;
     }
 
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    GLFWwindow* window = nullptr;
+    HeadlessContext headless;
 
-    GLFWwindow* window = glfwCreateWindow(1200, 700, "Parallelepiped Scene with Textured Spheres", nullptr, nullptr);
-    if (!window)
+    if (benchMode)
     {
-        std::cerr << "Failed to create GLFW window\n";
-        glfwTerminate();
-        return -1;
+        if (!createHeadlessContext(headless, windowWidth, windowHeight))
+            return -1;
+    }
+    else
+    {
+        if (!glfwInit())
+        {
+            std::cerr << "Failed to init GLFW\n";
+            return -1;
+        }
+
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+        window = glfwCreateWindow(windowWidth, windowHeight, windowTitle, nullptr, nullptr);
+        if (!window)
+        {
+            std::cerr << "Failed to create GLFW window\n";
+            glfwTerminate();
+            return -1;
+        }
+        glfwMakeContextCurrent(window);
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_HIDDEN);
+        glfwSetCursorPosCallback(window, mouse_callback);
+        glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+        // The framebuffer can be larger than the window on high-DPI displays
+        glfwGetFramebufferSize(window, &windowWidth, &windowHeight);
+
+        if (!recordPath.empty())
+        {
+            // Everything but --record itself is kept, so the replay sets up the same scene
+            std::vector<std::string> arguments;
+            for (int i = 1; i < argc; ++i)
+            {
+                if (std::string(argv[i]) == "--record")
+                    ++i;
+                else
+                    arguments.push_back(argv[i]);
+            }
+            if (!inputRecording.open(recordPath, 1.0 / tickRate, windowWidth, windowHeight, arguments))
+            {
+                std::cerr << "Failed to open " << recordPath << " for recording\n";
+                return -1;
+            }
+        }
     }
-    glfwMakeContextCurrent(window);
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_HIDDEN);
-    glfwSetCursorPosCallback(window, mouse_callback);
 
     glewExperimental = GL_TRUE;
-    if (glewInit() != GLEW_OK)
+    GLenum glewStatus = glewInit();
+    // GLX builds of GLEW report a missing X display under EGL after loading the core entry points
+    if (glewStatus != GLEW_OK && !(benchMode && glewStatus == GLEW_ERROR_NO_GLX_DISPLAY))
     {
         std::cerr << "Failed to init GLEW\n";
         return -1;
     }
 
-    glEnable(GL_DEPTH_TEST);
+    if (benchMode && !createHeadlessFramebuffer(headless))
+        return -1;
 
-    GLuint shaderProgram = createShaderProgram();
+    glEnable(GL_DEPTH_TEST);
 
-    // Cube VAO and VBO
-    GLuint cubeVAO, cubeVBO;
+    // Zones stay on unless disabled; --trace additionally keeps every event
+    profiler().enabled = profilerEnabled;
+    profiler().tracing = profilerEnabled && !tracePath.empty();
+    profiler().initGpu();
+
+    // Linked programs are cached on disk, keyed by their sources and the driver
+    ProgramCache programCache;
+    initProgramCache(programCache, shaderCacheDirectory);
+    ShaderProgram sceneShader = createSceneShader(&programCache);
+    PassPrograms scenePasses = createPassPrograms(vertexShaderSource, shaderHeader, "FrameData", kFrameDataBinding, &programCache);
+
+    // Camera and light state is uploaded once per frame into this buffer
+    GLint uniformAlignment = 16;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+    StreamBuffer frameStream;
+    frameStream.create(sizeof(FrameData), (size_t)std::max(uniformAlignment, 16));
+
+    // Cube VAO, VBO, and EBO: the unrolled cube becomes a 24-vertex indexed mesh
+    std::vector<float> cubeMeshVertices;
+    std::vector<unsigned int> cubeMeshIndices;
+    buildCubeMesh(cubeMeshVertices, cubeMeshIndices);
+    std::vector<PackedVertex> cubePacked = packVertices(cubeMeshVertices);
+    std::vector<unsigned short> cubeIndices(cubeMeshIndices.begin(), cubeMeshIndices.end());
+    MeshLod cubeMesh = { 0, (int)cubeIndices.size(), (int)cubePacked.size() };
+
+    GLuint cubeVAO, cubeVBO, cubeEBO;
     glGenVertexArrays(1, &cubeVAO);
     glBindVertexArray(cubeVAO);
 
     glGenBuffers(1, &cubeVBO);
     glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(cubeVertices), cubeVertices, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, cubePacked.size() * sizeof(PackedVertex), cubePacked.data(), GL_STATIC_DRAW);
+
+    glGenBuffers(1, &cubeEBO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cubeEBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, cubeIndices.size() * sizeof(unsigned short), cubeIndices.data(), GL_STATIC_DRAW);
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-    glEnableVertexAttribArray(2);
+    setPackedVertexAttributes();
 
     glBindVertexArray(0);
 
-    // Sphere VAO, VBO, and EBO
-    std::vector<float> sphereVertices;
-    std::vector<unsigned int> sphereIndices;
-    generateSphere(0.5f, 32, 32, sphereVertices, sphereIndices);
+    // Sphere VAO, VBO, and EBO holding every level of detail
+    SphereLodChain sphereLods = buildSphereLodChain(kSphereRadius);
+    std::vector<PackedVertex> spherePacked = packVertices(sphereLods.vertices);
 
     GLuint sphereVAO, sphereVBO, sphereEBO;
     glGenVertexArrays(1, &sphereVAO);
@@ -429,142 +658,625 @@ int main()
 
     glGenBuffers(1, &sphereVBO);
     glBindBuffer(GL_ARRAY_BUFFER, sphereVBO);
-    glBufferData(GL_ARRAY_BUFFER, sphereVertices.size() * sizeof(float), sphereVertices.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, spherePacked.size() * sizeof(PackedVertex), spherePacked.data(), GL_STATIC_DRAW);
 
     glGenBuffers(1, &sphereEBO);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sphereEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sphereIndices.size() * sizeof(unsigned int), sphereIndices.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sphereLods.indices.size() * sizeof(unsigned short), sphereLods.indices.data(), GL_STATIC_DRAW);
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-    glEnableVertexAttribArray(2);
+    setPackedVertexAttributes();
 
     glBindVertexArray(0);
 
-    // Load textures
-    GLuint floorTexture = loadTexture("grass.jpg");
-    GLuint sunTexture = loadTexture("sun.jpeg");
-    GLuint planet1Texture = loadTexture("earth.jpg");
-    GLuint planet2Texture = loadTexture("mars.jpg");
-    GLuint moonTexture = loadTexture("moon.jpg");
-    GLuint skyTexture = loadTexture("sky.jpeg");
+    // Scene draws go through a state-sorted queue that batches them into instanced draws
+    const float farPlane = 100.0f;
+    RenderQueue renderQueue = createRenderQueue(farPlane);
+    enableDrawInstanceAttributes(renderQueue, cubeVAO);
+    enableDrawInstanceAttributes(renderQueue, sphereVAO);
+
+    // Textures load on the pool from the cooked texture cache and stream in over the first frames
+    ThreadPool threadPool(threadCount);
+    TextureManager textures(threadPool, compressTextures);
+
+    // Scene graph, filled from the scene file. Materials and orbits are read up front;
+    // nodes and objects stream in a chunk per frame, so large scenes start drawing
+    // before they are fully read. Bench runs load everything before the first frame.
+    SceneFile sceneFile;
+    std::string sceneError;
+    if (!openScene(scenePath, sceneFile, sceneError))
+    {
+        std::cerr << "Failed to load scene " << scenePath << ": " << sceneError << std::endl;
+        return -1;
+    }
+    SceneGraph scene;
+    std::vector<SceneObject> sceneObjects;
+    std::vector<Orbit> orbits;
 
-    glm::mat4 projectionMatrix = glm::perspective(glm::radians(70.0f), 1200.0f / 700.0f, 0.01f, 100.0f);
+    const SceneFileHeader& sceneHeader = sceneFile.header();
+    std::vector<int> materialTextures;
+    for (uint32_t i = 0; i < sceneHeader.materialCount; ++i)
+    {
+        const char* texture = sceneFile.string(sceneFile.materials()[i].texture);
+        materialTextures.push_back(texture ? textures.request(texture) : -1);
+    }
+    for (uint32_t i = 0; i < sceneHeader.orbitCount; ++i)
+    {
+        const SceneFileOrbit& orbit = sceneFile.orbits()[i];
+        orbits.push_back({ (int)orbit.node, orbit.radius, orbit.speed, orbit.height });
+    }
+    scene.reserve(sceneHeader.nodeCount);
+    sceneObjects.reserve(sceneHeader.objectCount);
+
+    auto loadSceneChunk = [&](uint32_t maxNodes) {
+        SceneChunk chunk;
+        if (!sceneFile.nextChunk(maxNodes, chunk, sceneError))
+            return false;
+        for (uint32_t i = chunk.nodeBegin; i < chunk.nodeEnd; ++i)
+        {
+            const SceneFileNode& node = sceneFile.nodes()[i];
+            scene.addNode(node.parent, glm::make_mat4(node.local));
+        }
+        for (uint32_t i = chunk.objectBegin; i < chunk.objectEnd; ++i)
+        {
+            const SceneFileObject& object = sceneFile.objects()[i];
+            const SceneFileMaterial& material = sceneFile.materials()[object.material];
+            bool isSphere = object.mesh == SceneMeshSphere;
+            glm::vec3 color(material.color[0], material.color[1], material.color[2]);
+            sceneObjects.push_back({ (int)object.node, isSphere ? sphereVAO : cubeVAO, materialTextures[object.material], color, isSphere });
+        }
+        return true;
+    };
+    auto sceneLoadStart = std::chrono::steady_clock::now();
+    bool sceneLoaded = loadSceneChunk(benchMode ? UINT32_MAX : kSceneChunkNodes);
+    if (benchMode && sceneLoaded)
+    {
+        double sceneMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sceneLoadStart).count();
+        std::cout << "scene: " << sceneHeader.nodeCount << " nodes, " << sceneHeader.objectCount << " objects, "
+                  << sceneHeader.orbitCount << " orbits loaded in " << sceneMs << " ms\n";
+    }
+    if (!sceneLoaded)
+    {
+        std::cerr << "Failed to load scene " << scenePath << ": " << sceneError << std::endl;
+        return -1;
+    }
+
+    bool depthPrepass = prepassOption < 0 ? (sceneHeader.flags & SceneFlagDepthPrepass) != 0 : prepassOption == 1;
+
+    // World bounds of every scene object, refreshed per frame for culling
+    std::vector<AABB> objectBounds;
+    std::vector<int> visibleObjects;
+    BVH sceneBVH;
+
+    // Instanced belt of small orbiting bodies, sharing the sphere LOD buffers
+    std::vector<const char*> bodyTextureFiles = { "moon.jpg", "mars.jpg" };
+    std::vector<OrbitingBody> bodies = generateAsteroidBelt(bodyCount, (int)bodyTextureFiles.size());
+    GLuint bodyTextureArray = bodies.empty() ? 0 : loadTextureArray(bodyTextureFiles, 256);
+    BodyRenderer bodyRenderer = createBodyRenderer(bodies, sphereLods, sphereVBO, sphereEBO, bodyTextureArray, shaderHeader,
+                                                   &programCache);
+    bindUniformBlock(bodyRenderer.program, "FrameData", kFrameDataBinding);
+    bindLightingSamplers(bodyRenderer.program);
+    PassPrograms bodyPasses = createPassPrograms(bodyVertexShaderSource, shaderHeader, "FrameData", kFrameDataBinding, &programCache);
+
+    OrbitalSimulation simulation;
+    simulation.mode = gravityMode ? SimulationGravity : SimulationKepler;
+    simulation.pool = &threadPool;
+    addBodiesToSimulation(simulation, bodies);
+
+    // Lights, orbits and bodies advance in fixed ticks on their own thread, and the
+    // render loop draws a blend of the two newest ticks. Bench runs tick once per frame
+    // on the render thread instead, so their frames stay reproducible; replays tick on
+    // the render thread at the recorded rate.
+    double tickSeconds = replaying ? replayLog.tickSeconds : benchMode ? benchTimestep : 1.0 / tickRate;
+    SimulationLoop simulationLoop(tickSeconds, [&](double tickTime, double dt, SimulationState& state) {
+        float time = (float)tickTime;
+        state.lightPos = glm::vec3(10.0f * sin(time), lightPos.y, 10.0f * cos(time));
+        state.lightPos2 = glm::vec3(30.0f * sin(time), lightPos2.y, 30.0f * cos(time));
+        state.orbitPositions.resize(orbits.size());
+        for (size_t i = 0; i < orbits.size(); ++i)
+            state.orbitPositions[i] = orbitPosition(orbits[i], time);
+        simulation.update(time, std::min((float)dt, 0.05f));
+        state.bodies.x = simulation.bodies.x;
+        state.bodies.y = simulation.bodies.y;
+        state.bodies.z = simulation.bodies.z;
+    });
+    SimulationState renderState;
+
+    glm::mat4 projectionMatrix = glm::perspective(glm::radians(70.0f), (float)windowWidth / windowHeight, 0.01f, farPlane);
+
+    // Point lights: the two room lights first, then a warm emitter on each of the first belt bodies
+    int emitterCount = lightCount < 0 ? (int)bodies.size() : std::min(lightCount, (int)bodies.size());
+    std::vector<PointLight> lights;
+    lights.push_back({ lightPos, kRoomLightRadius, glm::vec3(1.0f) });
+    lights.push_back({ lightPos2, kRoomLightRadius, lightColor2 });
+    for (int i = 0; i < emitterCount; ++i)
+    {
+        glm::vec3 warm = glm::mix(bodies[i].color, glm::vec3(1.0f, 0.6f, 0.25f), 0.7f);
+        lights.push_back({ glm::vec3(0.0f), kEmitterRadius, warm * 0.8f });
+    }
+    LightClusters lightClusters = createLightClusters(farPlane);
+
+    BenchRecorder bench;
+    if (benchMode)
+    {
+        bench.init(benchFrames, std::min(benchWarmup, benchFrames - 1));
+
+        // Bench frames must not depend on how fast the textures decode
+        textures.finish();
+        std::cout << "textures: loaded in " << textures.loadMilliseconds() << " ms on " << threadPool.threadCount() << " threads ("
+                  << textures.cachedCount() << " from cache, " << textures.cookedCount() << " cooked, "
+                  << textures.textureBytes() / 1024 << " KB)\n";
+        std::cout << "depth prepass: " << (depthPrepass ? "on" : "off") << (overdrawMode ? ", counting overdraw" : "")
+                  << (occlusionCulling ? ", occlusion culling" : "") << "\n";
+        std::cout << "shaders: " << programCache.programs << " programs, " << programCache.hits
+                  << " from cache in " << programCache.loadMs << " ms, compile " << programCache.compileMs << " ms, link "
+                  << programCache.linkMs << " ms\n";
+    }
+
+    // Created on first use of the overdraw mode
+    OverdrawCounter overdrawCounter;
+    GLuint frameFramebuffer = benchMode ? headless.fbo : 0;
+
+    OcclusionCuller occlusionCuller;
+    if (occlusionCulling)
+        occlusionCuller.create(shaderHeader, "FrameData", kFrameDataBinding, &programCache);
+
+    // Scaled rendering goes through an offscreen target. The controller picks the scale
+    // from the frame time unless --resolution-scale fixes it; bench runs stay at full
+    // resolution unless asked, so their frames remain comparable.
+    bool dynamicResolution = resolutionScale <= 0.0f && (dynamicResolutionOption < 0 ? !benchMode : dynamicResolutionOption == 1);
+    bool scaledRendering = dynamicResolution || (resolutionScale > 0.0f && resolutionScale < 1.0f);
+    ResolutionController resolutionController;
+    resolutionController.targetMs = frameBudgetMs;
+    resolutionController.minScale = minResolutionScale;
+    SceneTarget sceneTarget;
+    GpuFrameTimer gpuFrameTimer;
+    if (scaledRendering && !createSceneTarget(sceneTarget, windowWidth, windowHeight, &programCache))
+        return -1;
+    if (dynamicResolution)
+        gpuFrameTimer.create();
+    if (benchMode && dynamicResolution)
+        std::cout << "resolution: dynamic, " << frameBudgetMs << " ms budget, scale " << minResolutionScale << "-1\n";
+    else if (benchMode && scaledRendering)
+        std::cout << "resolution: fixed scale " << resolutionScale << "\n";
+
+    // Per-frame data is written in place into these ring buffers
+    std::vector<StreamBuffer*> streams = { &frameStream, &renderQueue.instanceStream, &bodyRenderer.instanceStream };
+    if (lightClusters.textureRanges)
+    {
+        for (StreamBuffer& stream : lightClusters.streams)
+            streams.push_back(&stream);
+    }
+
+    // Tick 0 is the initial state, so the first frame always has a snapshot to draw
+    simulationLoop.advanceTo(0.0);
+    if (!benchMode)
+        simulationLoop.start();
 
     // Rendering loop
-    while (!glfwWindowShouldClose(window))
+    int frameCount = 0;
+    bool checksPassed = true;    // golden frames and the timing baseline
+    while (benchMode ? frameCount < benchFrames : !glfwWindowShouldClose(window))
     {
-        glfwPollEvents();
+        if (benchMode)
+            bench.beginFrame();
+        auto frameStart = std::chrono::steady_clock::now();
+        if (dynamicResolution)
+            gpuFrameTimer.beginFrame();
+        profiler().beginFrame();
+        if (benchMode && frameCount == benchWarmup)
+            profiler().resetRun();
+
+        {
+            ProfileZone zone("textures");
+            textures.update();
+        }
+        if (!sceneFile.done())
+        {
+            ProfileZone zone("scene.load");
+            if (!loadSceneChunk(kSceneChunkNodes))
+            {
+                std::cerr << "Failed to load scene " << scenePath << ": " << sceneError << std::endl;
+                sceneFile.close();
+            }
+        }
+        for (StreamBuffer* stream : streams)
+            stream->beginFrame();
+
+        // Window resizes reach the projection, the scene target and the overdraw counter.
+        // Replays render at the recorded size, so a recording ends at the first resize.
+        if (framebufferResized)
+        {
+            framebufferResized = false;
+            if (inputRecording.isOpen())
+            {
+                inputRecording.close();
+                std::cout << "Window resized, recording stopped after " << frameCount << " frames\n";
+            }
+            projectionMatrix = glm::perspective(glm::radians(70.0f), (float)windowWidth / windowHeight, 0.01f, farPlane);
+            glViewport(0, 0, windowWidth, windowHeight);
+            if (scaledRendering)
+                resizeSceneTarget(sceneTarget, windowWidth, windowHeight);
+            if (overdrawCounter.fbo)
+                destroyOverdrawCounter(overdrawCounter);
+        }
+        GLuint sceneFramebuffer = frameFramebuffer;
+        int renderWidth = windowWidth, renderHeight = windowHeight;
+        if (scaledRendering)
+        {
+            beginSceneTarget(sceneTarget, dynamicResolution ? resolutionController.scale : resolutionScale);
+            sceneFramebuffer = sceneTarget.fbo;
+            renderWidth = sceneTarget.renderWidth;
+            renderHeight = sceneTarget.renderHeight;
+        }
 
         glClearColor(0.3f, 0.3f, 0.3f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        float time = glfwGetTime();
-        lightPos.x = 10.0f * sin(time);
-        lightPos.z = 10.0f * cos(time);
+        // Bench runs use a fixed simulated timestep so every run renders the same frames.
+        // Otherwise the render time trails the simulation clock by one tick, so there is
+        // normally a tick on either side of it to blend between.
+        // A replay advances to the tick that was drawn when it was recorded.
+        double time;
+        const InputLogFrame* replayFrame = replaying ? &replayLog.frames[frameCount] : nullptr;
+        if (replayFrame)
+        {
+            time = replayFrame->time;
+            simulationLoop.advanceTo(replayFrame->tick * simulationLoop.tickSeconds);
+        }
+        else if (benchMode)
+        {
+            time = frameCount * (double)benchTimestep;
+            simulationLoop.advanceTo(time);
+        }
+        else
+        {
+            time = simulationLoop.elapsed() - simulationLoop.tickSeconds;
+        }
+        uint64_t drawnTick;
+        {
+            ProfileZone zone("simulation");
+            const SimulationLoop::Snapshot& snapshot = simulationLoop.latest();
+            interpolateState(snapshot, time, renderState);
+            drawnTick = snapshot.tick;
+        }
+
+        // Input is sampled last, right before the camera is built from it
+        float now = benchMode ? (float)time : (float)glfwGetTime();
+        deltaTime = replayFrame ? replayFrame->deltaTime : now - lastFrame;
+        lastFrame = now;
+        if (window)
+        {
+            ProfileZone zone("input");
+            glfwPollEvents();
+            uint8_t keys = readKeys(window);
+            processInput(window, keys);
+            inputRecording.endFrame(time, drawnTick, deltaTime, keys);
+        }
+        else if (replayFrame)
+        {
+            size_t first = replayLog.firstCursor[frameCount];
+            for (size_t i = first; i < first + replayFrame->cursorEvents; ++i)
+                mouse_callback(nullptr, replayLog.cursors[i].x, replayLog.cursors[i].y);
+            processInput(nullptr, replayFrame->keys);
+        }
+
+        glm::mat4 viewMatrix = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
+
+        ClusterStats clusterStats;
+        {
+            ProfileZone zone("lights");
+            lights[0].position = renderState.lightPos;
+            lights[1].position = renderState.lightPos2;
+            for (int i = 0; i < emitterCount; ++i)
+                lights[2 + i].position = glm::vec3(renderState.bodies.x[i], renderState.bodies.y[i], renderState.bodies.z[i]);
+            updateLightClusters(lightClusters, lights, viewMatrix, projectionMatrix, renderWidth, renderHeight, &threadPool,
+                                clusterStats);
+        }
 
-        lightPos2.x = 30.0f * sin(time);
-        lightPos2.z = 30.0f * cos(time);
+        StreamAllocation frameAllocation = frameStream.allocate(sizeof(FrameData));
+        if (FrameData* frameData = (FrameData*)frameAllocation.data)
+        {
+            frameData->viewMatrix = viewMatrix;
+            frameData->projectionMatrix = projectionMatrix;
+            frameData->viewPos = glm::vec4(cameraPos, 1.0f);
+            frameData->ambientColor = glm::vec4(0.2f);
+            frameData->clusterScale = lightClusters.scale;
+            frameData->clusterDims = glm::ivec4(kClusterGridX, kClusterGridY, kClusterGridZ, 0);
+        }
+        frameStream.unmap();
+        glBindBufferRange(GL_UNIFORM_BUFFER, kFrameDataBinding, frameStream.buffer(), frameAllocation.offset, sizeof(FrameData));
 
-        glUseProgram(shaderProgram);
-        glUniform3fv(glGetUniformLocation(shaderProgram, "lightPos"), 1, glm::value_ptr(lightPos));
-        glUniform3fv(glGetUniformLocation(shaderProgram, "viewPos"), 1, glm::value_ptr(cameraPos));
-        glUniform3fv(glGetUniformLocation(shaderProgram, "lightPos2"), 1, glm::value_ptr(lightPos2));
-        glUniform3fv(glGetUniformLocation(shaderProgram, "lightColor2"), 1, glm::value_ptr(lightColor2));
+        Frustum frustum = extractFrustum(projectionMatrix * viewMatrix);
+        CullStats objectCullStats;
+        {
+            ProfileZone zone("culling");
+            // Only the orbit pivots move; their subtrees are refreshed and the room stays untouched
+            for (size_t i = 0; i < orbits.size(); ++i)
+            {
+                if (orbits[i].node < (int)scene.parent.size())
+                    scene.setLocal(orbits[i].node, glm::translate(glm::mat4(1.0f), renderState.orbitPositions[i]));
+            }
+            scene.updateWorldTransforms();
+
+            // Frustum culling: refit the BVH over the objects' world bounds and keep what is visible
+            objectBounds.resize(sceneObjects.size());
+            for (size_t i = 0; i < sceneObjects.size(); ++i)
+            {
+                const SceneObject& object = sceneObjects[i];
+                objectBounds[i] = transformBounds(object.isSphere ? kSphereBounds : kCubeBounds, scene.world[object.node]);
+            }
+            sceneBVH.update(objectBounds);
+
+            visibleObjects.clear();
+            sceneBVH.cull(frustum, objectBounds, visibleObjects, objectCullStats);
+            // Keep submission order stable regardless of BVH layout
+            std::sort(visibleObjects.begin(), visibleObjects.end());
+        }
 
-        glm::vec3 lightColor = glm::vec3(1.0f);
-        glUniform3fv(glGetUniformLocation(shaderProgram, "lightColor"), 1, &lightColor[0]);
+        // Last frame's occlusion results that have arrived by now
+        if (occlusionCulling)
+            occlusionCuller.beginFrame(sceneObjects.size());
 
-        float currentFrame = glfwGetTime();
-        deltaTime = currentFrame - lastFrame;
-        lastFrame = currentFrame;
+        float pixelScale = projectionMatrix[1][1] * renderHeight * 0.5f;
+        int trianglesDrawn = 0;
+        RenderQueueStats queueStats;
+        {
+            ProfileZone zone("scene");
+            // Spheres pick their tessellation from the projected radius in pixels
+            for (int index : visibleObjects)
+            {
+                if (occlusionCulling && occlusionCuller.objectHidden(index))
+                {
+                    ++objectCullStats.objectsCulled;
+                    ++objectCullStats.objectsOccluded;
+                    continue;
+                }
+                SceneObject& object = sceneObjects[index];
+                const glm::mat4& world = scene.world[object.node];
+                const MeshLod* mesh = &cubeMesh;
+                if (object.isSphere)
+                {
+                    float radius = kSphereRadius * glm::length(glm::vec3(world[0]));
+                    float distance = glm::length(glm::vec3(world[3]) - cameraPos);
+                    object.lod = selectLod(sphereLods.minPixelRadius, object.lod, projectedRadius(radius, distance, pixelScale));
+                    mesh = &sphereLods.lods[object.lod];
+                }
+                trianglesDrawn += mesh->indexCount / 3;
+
+                // Textured objects ignore their flat colour
+                GLuint texture = textures.get(object.texture);
+                DrawPacket packet;
+                packet.program = sceneShader.id;
+                packet.VAO = object.VAO;
+                packet.texture = texture;
+                packet.mesh = *mesh;
+                packet.instance.world = world;
+                packet.instance.color = texture ? glm::vec4(1.0f) : glm::vec4(object.color, 1.0f);
+                packet.depth = glm::length(glm::vec3(world[3]) - cameraPos);
+                packet.conditionQuery = occlusionCulling ? occlusionCuller.pendingQuery(index) : 0;
+                submitDraw(renderQueue, packet);
+            }
+            sortRenderQueue(renderQueue, queueStats);
+        }
 
-        processInput(window);
+        // Asteroid belt, one instanced draw per sphere LOD
+        CullStats bodyCullStats;
+        {
+            ProfileZone zone("bodies");
+            updateBodyInstances(bodyRenderer, renderState.bodies, frustum, cameraPos, pixelScale, &threadPool, bodyCullStats,
+                                occlusionCulling ? &occlusionCuller : nullptr);
+        }
 
-        glm::mat4 viewMatrix = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
+        // Overdraw mode swaps the shading programs for the counting variants
+        if (overdrawMode && !overdrawCounter.fbo)
+            overdrawCounter = createOverdrawCounter(windowWidth, windowHeight, &programCache);
+        if (overdrawMode)
+            beginOverdrawCount(overdrawCounter);
+        GLuint sceneProgram = overdrawMode ? scenePasses.count.id : 0;
+        GLuint bodyProgram = overdrawMode ? bodyPasses.count.id : 0;
 
-        // Draw floor
-        glm::mat4 floorMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -0.51f, 0.0f)) *
-                                glm::scale(glm::mat4(1.0f), glm::vec3(30.0f, 0.02f, 30.0f));
-        glm::vec3 floorColor = glm::vec3(0.0f, 1.0f, 0.0f);
-        drawObject(shaderProgram, cubeVAO, floorMatrix, floorColor, viewMatrix, projectionMatrix, floorTexture);
-
-        // Draw ceiling
-        glm::mat4 ceilingMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 10.0f, 0.0f)) *
-                                  glm::scale(glm::mat4(1.0f), glm::vec3(30.0f, 0.02f, 30.0f));
-        glm::vec3 wallColor = glm::vec3(0.529f, 0.808f, 0.922f);
-        drawObject(shaderProgram, cubeVAO, ceilingMatrix, wallColor, viewMatrix, projectionMatrix);
-
-        // Draw walls
-        glm::mat4 wall1 = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -15.0f)) *
-                          glm::scale(glm::mat4(1.0f), glm::vec3(30.0f, 30.0f, 0.1f));
-        drawObject(shaderProgram, cubeVAO, wall1, wallColor, viewMatrix, projectionMatrix, skyTexture);
-
-        glm::mat4 wall2 = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, 15.0f)) *
-                          glm::scale(glm::mat4(1.0f), glm::vec3(30.0f, 30.0f, 0.1f));
-        drawObject(shaderProgram, cubeVAO, wall2, wallColor, viewMatrix, projectionMatrix, skyTexture);
-
-        glm::mat4 wall3 = glm::translate(glm::mat4(1.0f), glm::vec3(-15.0f, 0.0f, 0.0f)) *
-                          glm::scale(glm::mat4(1.0f), glm::vec3(0.1f, 30.0f, 30.0f));
-        drawObject(shaderProgram, cubeVAO, wall3, wallColor, viewMatrix, projectionMatrix, skyTexture);
-
-        glm::mat4 wall4 = glm::translate(glm::mat4(1.0f), glm::vec3(15.0f, 0.0f, 0.0f)) *
-                          glm::scale(glm::mat4(1.0f), glm::vec3(0.1f, 30.0f, 30.0f));
-        drawObject(shaderProgram, cubeVAO, wall4, wallColor, viewMatrix, projectionMatrix, skyTexture);
-
-        // Draw spheres
-        // Central sphere
-        glm::mat4 centerSphereMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 1.0f, 0.0f)) *
-                                       glm::scale(glm::mat4(1.0f), glm::vec3(1.0f));
-        glm::vec3 centerSphereColor = glm::vec3(1.0f, 1.0f, 0.0f); // Yellow (fallback)
-        drawObject(shaderProgram, sphereVAO, centerSphereMatrix, centerSphereColor, viewMatrix, projectionMatrix, sunTexture, true, sphereEBO, sphereIndices.size());
-
-        // Orbiting sphere 1
-        float orbitRadius1 = 5.0f;
-        float orbitSpeed1 = 1.0f;
-        glm::vec3 orbitSphere1Pos = glm::vec3(sin(time * orbitSpeed1) * orbitRadius1, 1.0f, cos(time * orbitSpeed1) * orbitRadius1);
-        glm::mat4 orbitSphere1Matrix = glm::translate(glm::mat4(1.0f), orbitSphere1Pos) *
-                                       glm::scale(glm::mat4(1.0f), glm::vec3(0.5f));
-        glm::vec3 orbitSphere1Color = glm::vec3(1.0f, 0.0f, 0.0f); // Red (fallback)
-        drawObject(shaderProgram, sphereVAO, orbitSphere1Matrix, orbitSphere1Color, viewMatrix, projectionMatrix, planet1Texture, true, sphereEBO, sphereIndices.size());
-
-        // Orbiting sphere 2
-        float orbitRadius2 = 3.0f;
-        float orbitSpeed2 = 0.5f;
-        glm::mat4 orbitSphere2Matrix = glm::translate(glm::mat4(1.0f), glm::vec3(sin(time * orbitSpeed2) * orbitRadius2, 1.0f, cos(time * orbitSpeed2) * orbitRadius2)) *
-                                       glm::scale(glm::mat4(1.0f), glm::vec3(0.5f));
-        glm::vec3 orbitSphere2Color = glm::vec3(0.0f, 0.0f, 1.0f); // Blue (fallback)
-        drawObject(shaderProgram, sphereVAO, orbitSphere2Matrix, orbitSphere2Color, viewMatrix, projectionMatrix, planet2Texture, true, sphereEBO, sphereIndices.size());
-
-        // New sphere orbiting the first orbiting sphere
-        float orbitRadius3 = 0.8f;
-        float orbitSpeed3 = 2.0f;
-        glm::vec3 orbitSphere3RelativePos = glm::vec3(sin(time * orbitSpeed3) * orbitRadius3, 0.0f, cos(time * orbitSpeed3) * orbitRadius3);
-        glm::mat4 orbitSphere3Matrix = glm::translate(glm::mat4(1.0f), orbitSphere1Pos + orbitSphere3RelativePos) *
-                                       glm::scale(glm::mat4(1.0f), glm::vec3(0.3f));
-        glm::vec3 orbitSphere3Color = glm::vec3(0.0f, 1.0f, 0.0f); // Green (fallback)
-        drawObject(shaderProgram, sphereVAO, orbitSphere3Matrix, orbitSphere3Color, viewMatrix, projectionMatrix, moonTexture, true, sphereEBO, sphereIndices.size());
-
-        glfwSwapBuffers(window);
+        // The pre-pass lays down the nearest depth, so the shading pass runs once per pixel
+        if (depthPrepass)
+        {
+            ProfileZone zone("prepass");
+            GpuProfileZone gpuZone("prepass");
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            drawRenderQueue(renderQueue, queueStats, scenePasses.depth.id);
+            drawBodies(bodyRenderer, bodyPasses.depth.id);
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            glDepthFunc(GL_EQUAL);
+            glDepthMask(GL_FALSE);
+        }
+        {
+            ProfileZone zone("draw");
+            {
+                GpuProfileZone gpuZone("scene");
+                drawRenderQueue(renderQueue, queueStats, sceneProgram);
+            }
+            {
+                GpuProfileZone gpuZone("bodies");
+                drawBodies(bodyRenderer, bodyProgram);
+            }
+        }
+        clearRenderQueue(renderQueue);
+        if (depthPrepass)
+        {
+            glDepthFunc(GL_LESS);
+            glDepthMask(GL_TRUE);
+        }
+
+        // Every frustum-visible candidate, hidden or not, is tested against the finished depth
+        if (occlusionCulling)
+        {
+            ProfileZone zone("occlusion");
+            GpuProfileZone gpuZone("occlusion");
+            occlusionCuller.issueQueries(visibleObjects, objectBounds, renderState.bodies, bodyRenderer.maxSize * kSphereRadius,
+                                         frustum, cameraPos);
+            occlusionCuller.endFrame();
+        }
+
+        OverdrawStats overdrawStats;
+        if (overdrawMode)
+        {
+            ProfileZone zone("overdraw");
+            endOverdrawCount(overdrawCounter, overdrawStats, renderWidth, renderHeight);
+            glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer);
+            drawOverdrawHeatmap(overdrawCounter);
+        }
+
+        if (scaledRendering)
+        {
+            ProfileZone zone("upscale");
+            GpuProfileZone gpuZone("upscale");
+            upscaleSceneTarget(sceneTarget, frameFramebuffer, upscaleSharpness);
+        }
+
+        // Selected frames are written out, and checked against known-good ones
+        if (std::binary_search(dumpFrames.begin(), dumpFrames.end(), frameCount))
+        {
+            ProfileZone zone("dump");
+            // The readback stalls the pipeline, so this frame's time says nothing
+            if (benchMode)
+                bench.excludeFrame();
+            RgbImage image = captureFramebuffer(frameFramebuffer, windowWidth, windowHeight);
+            if (!writeFrame(dumpDirectory, frameCount, image))
+            {
+                std::cerr << "Failed to write " << framePath(dumpDirectory, frameCount) << "\n";
+                checksPassed = false;
+            }
+            if (!goldenDirectory.empty() &&
+                !checkGoldenFrame(image, framePath(goldenDirectory, frameCount), pixelTolerance, maxDifferingPixels))
+                checksPassed = false;
+        }
+
+        // Every draw reading this frame's streamed data has been issued
+        StreamStats streamStats;
+        for (StreamBuffer* stream : streams)
+        {
+            stream->endFrame();
+            streamStats.bytes += stream->stats().bytes;
+            streamStats.fenceWaits += stream->stats().fenceWaits;
+            streamStats.resizes += stream->stats().resizes;
+        }
+        for (size_t level = 0; level < bodyRenderer.lods.size(); ++level)
+            trianglesDrawn += bodyRenderer.lodCounts[level] * bodyRenderer.lods[level].indexCount / 3;
+
+        if (benchMode)
+        {
+            bench.setCounter("objects_tested", objectCullStats.objectsTested);
+            bench.setCounter("objects_culled", objectCullStats.objectsCulled);
+            bench.setCounter("bvh_nodes_tested", objectCullStats.nodesTested);
+            bench.setCounter("bodies_tested", bodyCullStats.objectsTested);
+            bench.setCounter("bodies_culled", bodyCullStats.objectsCulled);
+            if (occlusionCulling)
+            {
+                bench.setCounter("occlusion_queries", occlusionCuller.stats().queries);
+                bench.setCounter("occluded_objects", objectCullStats.objectsOccluded);
+                bench.setCounter("occluded_bodies", bodyCullStats.objectsOccluded);
+            }
+            bench.setCounter("triangles", trianglesDrawn);
+            bench.setCounter("draw_packets", queueStats.packets);
+            bench.setCounter("draw_calls", queueStats.drawCalls);
+            bench.setCounter("state_changes", queueStats.stateChanges());
+            bench.setCounter("stream_bytes", (double)streamStats.bytes);
+            bench.setCounter("fence_waits", streamStats.fenceWaits);
+            bench.setCounter("stream_resizes", streamStats.resizes);
+            bench.setCounter("lights", clusterStats.lights);
+            bench.setCounter("cluster_lights", clusterStats.references);
+            bench.setCounter("max_cluster_lights", clusterStats.maxPerCluster);
+            if (scaledRendering)
+                bench.setCounter("resolution_scale", (double)renderHeight / windowHeight);
+            if (overdrawMode)
+            {
+                bench.setCounter("shaded_fragments", (double)overdrawStats.fragments);
+                bench.setCounter("overdraw", overdrawStats.perCoveredPixel());
+                bench.setCounter("max_overdraw", overdrawStats.maxPerPixel);
+            }
+        }
+
+        // The swap is left out, so waiting for vsync does not count as load
+        if (dynamicResolution)
+        {
+            gpuFrameTimer.endFrame();
+            float cpuMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+            resolutionController.update(std::max(cpuMs, gpuFrameTimer.latestMs()));
+        }
+
+        {
+            ProfileZone zone("present");
+            if (benchMode)
+                bench.endFrame();
+            else
+                glfwSwapBuffers(window);
+        }
+        profiler().endFrame();
+        if (showProfile && window && frameCount % kProfilerWindow == 0)
+            glfwSetWindowTitle(window, profilerSummary(profiler().windowAverages()).c_str());
+        else if (overdrawMode && window && frameCount % kProfilerWindow == 0)
+        {
+            std::ostringstream title;
+            title << "overdraw: " << overdrawStats.perCoveredPixel() << " fragments per covered pixel, max " << overdrawStats.maxPerPixel;
+            glfwSetWindowTitle(window, title.str().c_str());
+        }
+        ++frameCount;
+    }
+
+    simulationLoop.stop();
+
+    if (benchMode)
+    {
+        bench.finish();
+        bench.printSummary();
+        profiler().finish();
+        for (const ZoneAverage& zone : profiler().runAverages())
+            std::cout << "  zone " << zone.name << " cpu " << zone.cpuMs << " ms  gpu " << zone.gpuMs << " ms  calls "
+                      << zone.calls << "\n";
+        if (!bench.writeCsv(benchOutput + ".csv") || !bench.writeJson(benchOutput + ".json", benchTimestep))
+            std::cerr << "Failed to write bench results to " << benchOutput << ".csv/.json\n";
+        if (!baselinePath.empty() && !checkTimingRegression(bench, baselinePath, maxRegressionPercent))
+            checksPassed = false;
+    }
+    inputRecording.close();
+
+    if (profilerEnabled && !tracePath.empty())
+    {
+        profiler().finish();
+        if (!profiler().writeChromeTrace(tracePath))
+            std::cerr << "Failed to write trace to " << tracePath << "\n";
     }
 
     glDeleteBuffers(1, &cubeVBO);
+    glDeleteBuffers(1, &cubeEBO);
     glDeleteBuffers(1, &sphereVBO);
     glDeleteBuffers(1, &sphereEBO);
     glDeleteVertexArrays(1, &cubeVAO);
     glDeleteVertexArrays(1, &sphereVAO);
-    glDeleteProgram(shaderProgram);
-    glDeleteTextures(1, &floorTexture);
-    glDeleteTextures(1, &sunTexture);
-    glDeleteTextures(1, &planet1Texture);
-    glDeleteTextures(1, &planet2Texture);
-    glDeleteTextures(1, &moonTexture);
-
-    glfwDestroyWindow(window);
-    glfwTerminate();
+    destroyBodyRenderer(bodyRenderer);
+    destroyLightClusters(lightClusters);
+    destroyRenderQueue(renderQueue);
+    destroyPassPrograms(scenePasses);
+    destroyPassPrograms(bodyPasses);
+    if (overdrawCounter.fbo)
+        destroyOverdrawCounter(overdrawCounter);
+    if (occlusionCulling)
+        occlusionCuller.destroy();
+    if (scaledRendering)
+        destroySceneTarget(sceneTarget);
+    if (dynamicResolution)
+        gpuFrameTimer.destroy();
+    frameStream.destroy();
+    glDeleteProgram(sceneShader.id);
+    textures.release();
+
+    if (benchMode)
+    {
+        destroyHeadlessContext(headless);
+    }
+    else
+    {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
 
-    return 0;
+    return checksPassed ? 0 : 1;
 }
\ No newline at end of file
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+#include "bench.h"
+#include "mappedfile.h"
+#include "scenejson.h"
+
+// Regression checks for bench and replay runs.
+//
+// Golden images: selected frames are read back and written as binary PPM files, and
+// optionally compared with the same frames from a known-good run. Rasterizers differ
+// in the last bit here and there, so a pixel only counts as different when a channel
+// is off by more than a small tolerance, and a frame fails when more than a given
+// fraction of its pixels do.
+//
+// Timing: the run's frame-time p95 is compared with the one in a bench.json written
+// by an earlier run, and fails when it grew by more than a given percentage.
+
+struct RgbImage
+{
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> pixels;    // top row first, 3 bytes per pixel
+};
+
+// Reads the colour buffer of `framebuffer`, flipped so the top row comes first
+inline RgbImage captureFramebuffer(GLuint framebuffer, int width, int height)
+{
+    RgbImage image;
+    image.width = width;
+    image.height = height;
+    std::vector<unsigned char> rows((size_t)width * height * 3);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, rows.data());
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+    size_t stride = (size_t)width * 3;
+    image.pixels.resize(rows.size());
+    for (int y = 0; y < height; ++y)
+        std::copy_n(&rows[(height - 1 - y) * stride], stride, &image.pixels[y * stride]);
+    return image;
+}
+
+inline bool writePpm(const std::string& path, const RgbImage& image)
+{
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+    fprintf(file, "P6\n%d %d\n255\n", image.width, image.height);
+    bool written = fwrite(image.pixels.data(), 1, image.pixels.size(), file) == image.pixels.size();
+    return fclose(file) == 0 && written;
+}
+
+// Binary PPM with 8-bit channels, as written by writePpm()
+inline bool readPpm(const std::string& path, RgbImage& image)
+{
+    std::vector<unsigned char> bytes;
+    if (!readFile(path, bytes))
+        return false;
+    bytes.push_back('\0');
+    const char* text = (const char*)bytes.data();
+    int maxValue = 0, consumed = 0;
+    if (sscanf(text, "P6 %d %d %d%n", &image.width, &image.height, &maxValue, &consumed) != 3 || maxValue != 255 ||
+        image.width <= 0 || image.height <= 0)
+        return false;
+    size_t offset = (size_t)consumed + 1;    // one whitespace byte ends the header
+    size_t size = (size_t)image.width * image.height * 3;
+    if (bytes.size() - 1 < offset + size)
+        return false;
+    image.pixels.assign(bytes.begin() + offset, bytes.begin() + offset + size);
+    return true;
+}
+
+struct ImageDiff
+{
+    bool sameSize = false;
+    int differingPixels = 0;
+    int maxDifference = 0;        // largest channel difference anywhere
+    double differingFraction = 0.0;
+};
+
+inline ImageDiff compareImages(const RgbImage& a, const RgbImage& b, int channelTolerance)
+{
+    ImageDiff diff;
+    diff.sameSize = a.width == b.width && a.height == b.height;
+    if (!diff.sameSize)
+        return diff;
+    for (size_t i = 0; i < a.pixels.size(); i += 3)
+    {
+        int worst = 0;
+        for (int c = 0; c < 3; ++c)
+            worst = std::max(worst, std::abs((int)a.pixels[i + c] - (int)b.pixels[i + c]));
+        diff.maxDifference = std::max(diff.maxDifference, worst);
+        diff.differingPixels += worst > channelTolerance;
+    }
+    diff.differingFraction = (double)diff.differingPixels / ((size_t)a.width * a.height);
+    return diff;
+}
+
+// Frame numbers from a comma-separated list such as "0,100,250"
+inline bool parseFrameList(const char* text, std::vector<int>& frames)
+{
+    frames.clear();
+    while (*text)
+    {
+        char* end;
+        long frame = strtol(text, &end, 10);
+        if (end == text || frame < 0 || (*end != ',' && *end != '\0'))
+            return false;
+        frames.push_back((int)frame);
+        text = *end ? end + 1 : end;
+    }
+    std::sort(frames.begin(), frames.end());
+    return !frames.empty();
+}
+
+inline std::string framePath(const std::string& directory, int frame)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "frame_%05d.ppm", frame);
+    return directory + "/" + name;
+}
+
+// Writes a frame as directory/frame_NNNNN.ppm, creating the directory if needed
+inline bool writeFrame(const std::string& directory, int frame, const RgbImage& image)
+{
+    mkdir(directory.c_str(), 0755);
+    return writePpm(framePath(directory, frame), image);
+}
+
+// Compares a frame with its golden image; prints the verdict
+inline bool checkGoldenFrame(const RgbImage& image, const std::string& goldenPath, int channelTolerance, double maxFraction)
+{
+    RgbImage golden;
+    if (!readPpm(goldenPath, golden))
+    {
+        std::cerr << "golden: cannot read " << goldenPath << "\n";
+        return false;
+    }
+    ImageDiff diff = compareImages(image, golden, channelTolerance);
+    if (!diff.sameSize)
+    {
+        std::cout << "golden: " << goldenPath << " is " << golden.width << "x" << golden.height << ", the frame "
+                  << image.width << "x" << image.height << " FAILED\n";
+        return false;
+    }
+    bool passed = diff.differingFraction <= maxFraction;
+    std::cout << "golden: " << goldenPath << " " << diff.differingPixels << " pixels differ by more than " << channelTolerance
+              << " (max " << diff.maxDifference << ") " << (passed ? "ok" : "FAILED") << "\n";
+    return passed;
+}
+
+// Fewer timed frames than this still get compared, with a warning
+const size_t kMinRegressionFrames = 20;
+
+// Reads `section`.`field` (e.g. frame_ms.p95) from a bench.json
+inline bool readBenchTiming(const std::string& path, const char* section, const char* field, double& value, std::string& error)
+{
+    std::vector<unsigned char> bytes;
+    if (!readFile(path, bytes))
+    {
+        error = "cannot open " + path;
+        return false;
+    }
+    JsonValue root;
+    if (!JsonParser().parse(std::string(bytes.begin(), bytes.end()), root, error))
+        return false;
+    const JsonValue* summary = root.find(section);
+    const JsonValue* number = summary ? summary->find(field) : nullptr;
+    if (!number || number->type != JsonValue::Number)
+    {
+        error = path + " has no " + section + "." + field;
+        return false;
+    }
+    value = number->number;
+    return true;
+}
+
+// Compares the run's frame-time p95 with a baseline bench.json; prints the verdict.
+// A run with no timed frames, or a baseline without a p95, fails.
+inline bool checkTimingRegression(const BenchRecorder& bench, const std::string& baselinePath, double maxRegressionPercent)
+{
+    double baseline = 0.0;
+    std::string error;
+    if (!readBenchTiming(baselinePath, "frame_ms", "p95", baseline, error))
+    {
+        std::cerr << "regression: " << error << "\n";
+        return false;
+    }
+    if (baseline <= 0.0)
+    {
+        std::cerr << "regression: " << baselinePath << " has no frame p95 to compare with\n";
+        return false;
+    }
+    std::vector<double> frameTimes = bench.column(&FrameSample::frameMs);
+    if (frameTimes.empty())
+    {
+        std::cerr << "regression: no timed frames left after the warmup and the dumped frames, FAILED\n";
+        return false;
+    }
+    if (frameTimes.size() < kMinRegressionFrames)
+        std::cout << "regression: only " << frameTimes.size() << " timed frames, the p95 is not reliable\n";
+    double current = summarizeTimings(frameTimes).p95;
+    double change = (current - baseline) / baseline * 100.0;
+    bool passed = change <= maxRegressionPercent;
+    std::cout << "regression: frame p95 " << current << " ms, baseline " << baseline << " ms (" << (change >= 0.0 ? "+" : "")
+              << change << "%, limit +" << maxRegressionPercent << "%) " << (passed ? "ok" : "FAILED") << "\n";
+    return passed;
+}
@@ -0,0 +1,299 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "geometry.h"
+#include "streambuffer.h"
+
+// State-sorted draw submission. Draws are queued as packets during the frame; at the
+// end each packet gets a 64-bit key
+//
+//     bits 56-63 program   48-55 VAO   36-47 texture   24-35 mesh   0-23 depth
+//
+// where the state fields are small per-frame slot numbers, and the keys are radix
+// sorted. A frame with more distinct values than a field holds puts the rest in the
+// field's last slot, so they still sort next to each other without spilling into the
+// neighbouring field. Runs of packets with the same program, VAO, texture and index
+// range become one instanced draw; runs are split on the packets' actual state, not
+// on the key alone. The GL state is only touched when it differs from what the
+// previous batch left bound.
+//
+// Programs drawn through the queue read the world matrix from attributes 3-6 and the
+// colour from attribute 7 (see DrawInstance), and sample their texture on unit 0.
+// Untextured packets get a 1x1 white texture, so shaders can always multiply the
+// texel by the instance colour.
+//
+// executeRenderQueue() sorts, draws and empties the queue in one go. Multi-pass
+// frames call sortRenderQueue() once, drawRenderQueue() per pass (a depth pre-pass
+// draws every packet with its depth-only program) and then clearRenderQueue().
+//
+// A packet with a conditionQuery is drawn on its own inside glBeginConditionalRender,
+// so the GPU drops it if the query's box turned out hidden (see occlusion.h).
+
+struct DrawInstance
+{
+    glm::mat4 world;
+    glm::vec4 color;
+};
+
+struct DrawPacket
+{
+    GLuint program;
+    GLuint VAO;          // must have a 16-bit element buffer bound
+    GLuint texture;      // 0 for none
+    MeshLod mesh;
+    DrawInstance instance;
+    float depth;         // view distance, for front-to-back order within a batch
+    GLuint conditionQuery = 0;    // occlusion query to draw under, 0 to draw unconditionally
+};
+
+struct RenderQueueStats
+{
+    int packets = 0;
+    int drawCalls = 0;
+    int programChanges = 0;
+    int vaoChanges = 0;
+    int textureChanges = 0;
+
+    int stateChanges() const { return programChanges + vaoChanges + textureChanges; }
+};
+
+struct RenderQueue
+{
+    std::vector<DrawPacket> packets;
+    float farPlane = 100.0f;
+    StreamBuffer instanceStream;    // sorted instances, written in place each frame
+    GLuint whiteTexture = 0;
+
+    // Per-frame scratch
+    struct SortItem
+    {
+        uint64_t key;
+        uint32_t packet;
+    };
+    std::vector<SortItem> items;
+    std::vector<SortItem> sortScratch;
+    std::vector<uint32_t> programSlots, vaoSlots, textureSlots;
+    std::vector<uint64_t> meshSlots;
+    GLintptr instanceOffset = 0;    // of the sorted instances in instanceStream
+};
+
+// Attributes 3-7 read a DrawInstance per instance from the buffer bound to
+// GL_ARRAY_BUFFER, starting `offset` bytes in
+inline void setDrawInstanceAttributes(size_t offset)
+{
+    for (int column = 0; column < 4; ++column)
+        glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE, sizeof(DrawInstance),
+                              (void*)(offset + offsetof(DrawInstance, world) + column * sizeof(glm::vec4)));
+    glVertexAttribPointer(7, 4, GL_FLOAT, GL_FALSE, sizeof(DrawInstance), (void*)(offset + offsetof(DrawInstance, color)));
+}
+
+inline RenderQueue createRenderQueue(float farPlane)
+{
+    RenderQueue queue;
+    queue.farPlane = farPlane;
+    queue.instanceStream.create(64 * sizeof(DrawInstance));
+
+    const unsigned char white[] = { 255, 255, 255, 255 };
+    glGenTextures(1, &queue.whiteTexture);
+    glBindTexture(GL_TEXTURE_2D, queue.whiteTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return queue;
+}
+
+// Enables the per-instance attributes on a VAO that will be drawn through the queue
+inline void enableDrawInstanceAttributes(const RenderQueue& queue, GLuint VAO)
+{
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, queue.instanceStream.buffer());
+    setDrawInstanceAttributes(0);
+    for (int attribute = 3; attribute <= 7; ++attribute)
+    {
+        glEnableVertexAttribArray(attribute);
+        glVertexAttribDivisor(attribute, 1);
+    }
+    glBindVertexArray(0);
+}
+
+// Widths of the key fields
+const int kProgramSlotBits = 8;
+const int kVaoSlotBits = 8;
+const int kTextureSlotBits = 12;
+const int kMeshSlotBits = 12;
+
+// Whether two packets can share an instanced draw
+inline bool sameDrawState(const DrawPacket& a, const DrawPacket& b)
+{
+    return a.program == b.program && a.VAO == b.VAO && a.texture == b.texture && a.mesh.firstIndex == b.mesh.firstIndex &&
+           a.mesh.indexCount == b.mesh.indexCount;
+}
+
+inline void submitDraw(RenderQueue& queue, const DrawPacket& packet)
+{
+    queue.packets.push_back(packet);
+}
+
+// Stable LSD radix sort on the keys, 8 bits per pass. Passes where every key has
+// the same digit are skipped, so the unused high bits cost nothing.
+inline void radixSort(std::vector<RenderQueue::SortItem>& items, std::vector<RenderQueue::SortItem>& scratch)
+{
+    scratch.resize(items.size());
+    for (int shift = 0; shift < 64; shift += 8)
+    {
+        size_t counts[257] = {};
+        for (const RenderQueue::SortItem& item : items)
+            ++counts[((item.key >> shift) & 0xFF) + 1];
+        if (std::find(counts + 1, counts + 257, items.size()) != counts + 257)
+            continue;
+        for (int digit = 0; digit < 256; ++digit)
+            counts[digit + 1] += counts[digit];
+        for (const RenderQueue::SortItem& item : items)
+            scratch[counts[(item.key >> shift) & 0xFF]++] = item;
+        items.swap(scratch);
+    }
+}
+
+// Sorts this frame's packets and streams their instances in draw order. Returns
+// false when there is nothing to draw.
+inline bool sortRenderQueue(RenderQueue& queue, RenderQueueStats& stats)
+{
+    stats = RenderQueueStats();
+    stats.packets = (int)queue.packets.size();
+    queue.items.clear();
+    if (queue.packets.empty())
+        return false;
+
+    // Slot numbers are assigned in submission order and only need to be unique this frame;
+    // values past the field's capacity share its last slot
+    auto slot = [](auto& table, auto value, int bits) {
+        auto found = std::find(table.begin(), table.end(), value);
+        if (found == table.end())
+            found = table.insert(table.end(), value);
+        return std::min((uint64_t)(found - table.begin()), ((uint64_t)1 << bits) - 1);
+    };
+    queue.programSlots.clear();
+    queue.vaoSlots.clear();
+    queue.textureSlots.clear();
+    queue.meshSlots.clear();
+
+    queue.items.resize(queue.packets.size());
+    for (size_t i = 0; i < queue.packets.size(); ++i)
+    {
+        DrawPacket& packet = queue.packets[i];
+        if (packet.texture == 0)
+            packet.texture = queue.whiteTexture;
+        uint64_t mesh = (uint64_t)packet.mesh.firstIndex << 32 | (uint32_t)packet.mesh.indexCount;
+        float depth = std::min(std::max(packet.depth / queue.farPlane, 0.0f), 1.0f);
+        queue.items[i].key = slot(queue.programSlots, packet.program, kProgramSlotBits) << 56 |
+                             slot(queue.vaoSlots, packet.VAO, kVaoSlotBits) << 48 |
+                             slot(queue.textureSlots, packet.texture, kTextureSlotBits) << 36 |
+                             slot(queue.meshSlots, mesh, kMeshSlotBits) << 24 | (uint64_t)(depth * 0xFFFFFF);
+        queue.items[i].packet = (uint32_t)i;
+    }
+    radixSort(queue.items, queue.sortScratch);
+
+    // Instances in sorted order, so every batch is a contiguous range
+    StreamAllocation allocation = queue.instanceStream.allocate(queue.items.size() * sizeof(DrawInstance));
+    if (!allocation.data)
+    {
+        queue.items.clear();
+        return false;
+    }
+    DrawInstance* instances = (DrawInstance*)allocation.data;
+    for (size_t i = 0; i < queue.items.size(); ++i)
+        instances[i] = queue.packets[queue.items[i].packet].instance;
+    queue.instanceStream.unmap();
+    queue.instanceOffset = allocation.offset;
+    return true;
+}
+
+// Draws the sorted packets. A non-zero programOverride replaces every packet's
+// program and leaves textures unbound, for passes that do not shade.
+inline void drawRenderQueue(const RenderQueue& queue, RenderQueueStats& stats, GLuint programOverride = 0)
+{
+    if (queue.items.empty())
+        return;
+    glBindBuffer(GL_ARRAY_BUFFER, queue.instanceStream.buffer());
+
+    // Whatever was bound before the queue ran is unknown, so the first batch binds everything
+    GLuint program = 0, VAO = 0, texture = 0;
+    glActiveTexture(GL_TEXTURE0);
+    const uint64_t stateMask = ~(uint64_t)0xFFFFFF;
+    size_t begin = 0;
+    while (begin < queue.items.size())
+    {
+        const DrawPacket& packet = queue.packets[queue.items[begin].packet];
+        size_t end = begin + 1;
+        while (end < queue.items.size() && !packet.conditionQuery)
+        {
+            // Equal keys can still hide different state once a slot field has overflowed
+            const DrawPacket& next = queue.packets[queue.items[end].packet];
+            if (next.conditionQuery || (queue.items[end].key & stateMask) != (queue.items[begin].key & stateMask) ||
+                !sameDrawState(next, packet))
+                break;
+            ++end;
+        }
+
+        GLuint packetProgram = programOverride ? programOverride : packet.program;
+        if (packetProgram != program)
+        {
+            glUseProgram(packetProgram);
+            program = packetProgram;
+            ++stats.programChanges;
+        }
+        if (packet.VAO != VAO)
+        {
+            glBindVertexArray(packet.VAO);
+            VAO = packet.VAO;
+            ++stats.vaoChanges;
+        }
+        if (!programOverride && packet.texture != texture)
+        {
+            glBindTexture(GL_TEXTURE_2D, packet.texture);
+            texture = packet.texture;
+            ++stats.textureChanges;
+        }
+
+        // No base instance in GL 3.3: point the instance attributes at the batch instead
+        setDrawInstanceAttributes(queue.instanceOffset + begin * sizeof(DrawInstance));
+        if (packet.conditionQuery)
+            glBeginConditionalRender(packet.conditionQuery, GL_QUERY_NO_WAIT);
+        glDrawElementsInstanced(GL_TRIANGLES, packet.mesh.indexCount, GL_UNSIGNED_SHORT,
+                                (void*)(packet.mesh.firstIndex * sizeof(unsigned short)), (GLsizei)(end - begin));
+        if (packet.conditionQuery)
+            glEndConditionalRender();
+        ++stats.drawCalls;
+        begin = end;
+    }
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+inline void clearRenderQueue(RenderQueue& queue)
+{
+    queue.packets.clear();
+    queue.items.clear();
+}
+
+// Sorts and draws everything submitted this frame, then empties the queue
+inline void executeRenderQueue(RenderQueue& queue, RenderQueueStats& stats)
+{
+    if (sortRenderQueue(queue, stats))
+        drawRenderQueue(queue, stats);
+    clearRenderQueue(queue);
+}
+
+inline void destroyRenderQueue(RenderQueue& queue)
+{
+    queue.instanceStream.destroy();
+    glDeleteTextures(1, &queue.whiteTexture);
+    queue = RenderQueue();
+}
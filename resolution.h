@@ -0,0 +1,242 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "shader.h"
+
+// Dynamic resolution. The scene is drawn into the lower-left corner of an offscreen
+// target allocated at the output size, then stretched over the output by a bilinear
+// pass with optional sharpening. Changing the scale only changes the viewport, so the
+// target is reallocated on window resizes but never while the controller adjusts.
+//
+// ResolutionController is a PI controller on the frame time. It works on the rendered
+// area rather than the scale, since fragment cost grows with the number of pixels:
+// the proportional term reacts to the current error and the integral term holds the
+// area that meets the budget once it settles. The frame time it is fed is the larger of
+// the CPU time up to the present and the GPU time measured by GpuFrameTimer, so time
+// spent waiting for vsync in the swap does not read as load.
+
+struct ResolutionController
+{
+    float targetMs = 16.7f;
+    float minScale = 0.5f;
+    float maxScale = 1.0f;
+    float kp = 0.3f;
+    float ki = 0.1f;
+    float smoothing = 0.3f;    // weight of each new frame time in the filtered one
+
+    float filteredMs = 0.0f;
+    float integral = 1.0f;     // rendered area as a fraction of the output
+    float scale = 1.0f;
+
+    // Feeds the last frame's time and returns the scale for the next frame
+    float update(float frameMs)
+    {
+        filteredMs = filteredMs > 0.0f ? filteredMs + smoothing * (frameMs - filteredMs) : frameMs;
+        float error = std::min(std::max((targetMs - filteredMs) / targetMs, -1.0f), 1.0f);
+        float minArea = minScale * minScale, maxArea = maxScale * maxScale;
+        // Clamping the integral keeps it from winding up while the scale sits at a limit
+        integral = std::min(std::max(integral + ki * error, minArea), maxArea);
+        float area = std::min(std::max(integral + kp * error, minArea), maxArea);
+        scale = std::sqrt(area);
+        return scale;
+    }
+};
+
+const int kFrameTimerLatency = 4;
+
+// GPU time of recent frames from a pair of timestamps around each, so it does not
+// collide with a GL_TIME_ELAPSED query the bench keeps open. Results are polled and
+// only waited for when a slot comes round again still unread.
+class GpuFrameTimer
+{
+public:
+    void create() { glGenQueries(2 * kFrameTimerLatency, queries); }
+    void destroy() { glDeleteQueries(2 * kFrameTimerLatency, queries); }
+
+    // GPU milliseconds of the newest frame whose timestamps have arrived
+    float latestMs() const { return lastMs; }
+
+    void beginFrame()
+    {
+        // Oldest first, so lastMs ends on the newest frame that has finished
+        for (int i = 0; i < kFrameTimerLatency; ++i)
+        {
+            int slot = (frame + i) % kFrameTimerLatency;
+            GLuint available = 0;
+            if (issued[slot])
+                glGetQueryObjectuiv(queries[2 * slot + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available || (issued[slot] && slot == frame % kFrameTimerLatency))
+                collect(slot);
+        }
+        glQueryCounter(queries[2 * (frame % kFrameTimerLatency)], GL_TIMESTAMP);
+    }
+
+    void endFrame()
+    {
+        int slot = frame % kFrameTimerLatency;
+        glQueryCounter(queries[2 * slot + 1], GL_TIMESTAMP);
+        issued[slot] = true;
+        ++frame;
+    }
+
+private:
+    void collect(int slot)
+    {
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(queries[2 * slot], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(queries[2 * slot + 1], GL_QUERY_RESULT, &end);
+        lastMs = (float)((end - begin) / 1.0e6);
+        issued[slot] = false;
+    }
+
+    GLuint queries[2 * kFrameTimerLatency] = {};
+    bool issued[kFrameTimerLatency] = {};
+    int frame = 0;
+    float lastMs = 0.0f;
+};
+
+const char* const kUpscaleVertexSource = R"(#version 330 core
+void main() {
+    vec2 corner = vec2(gl_VertexID == 1 ? 3.0 : -1.0, gl_VertexID == 2 ? 3.0 : -1.0);
+    gl_Position = vec4(corner, 0.0, 1.0);
+}
+)";
+
+// Bilinear upscale of the rendered corner of the target. With sharpness above zero the
+// result is pushed away from the average of its four neighbours (one source texel
+// away) and clamped to their range, which restores some of the edge contrast lost to
+// the stretch without ringing.
+const char* const kUpscaleFragmentSource = R"(#version 330 core
+uniform sampler2D source;
+uniform vec2 outputSize;
+uniform vec2 renderSize;
+uniform float sharpness;
+out vec4 FragColor;
+
+void main() {
+    vec2 texel = 1.0 / vec2(textureSize(source, 0));
+    vec2 uv = gl_FragCoord.xy / outputSize * renderSize * texel;
+    // Stay half a texel inside the rendered area, so nothing outside it bleeds in
+    vec2 lo = 0.5 * texel, hi = (renderSize - 0.5) * texel;
+    vec3 color = texture(source, clamp(uv, lo, hi)).rgb;
+    if (sharpness > 0.0)
+    {
+        vec3 n = texture(source, clamp(uv + vec2(0.0, texel.y), lo, hi)).rgb;
+        vec3 s = texture(source, clamp(uv - vec2(0.0, texel.y), lo, hi)).rgb;
+        vec3 e = texture(source, clamp(uv + vec2(texel.x, 0.0), lo, hi)).rgb;
+        vec3 w = texture(source, clamp(uv - vec2(texel.x, 0.0), lo, hi)).rgb;
+        vec3 sharpened = color + sharpness * (color - 0.25 * (n + s + e + w));
+        color = clamp(sharpened, min(color, min(min(n, s), min(e, w))), max(color, max(max(n, s), max(e, w))));
+    }
+    FragColor = vec4(color, 1.0);
+}
+)";
+
+struct SceneTarget
+{
+    GLuint fbo = 0;
+    GLuint colorTexture = 0;
+    GLuint depthBuffer = 0;
+    int width = 0;     // allocated size, the output size
+    int height = 0;
+    int renderWidth = 0;    // scaled size drawn this frame
+    int renderHeight = 0;
+    ShaderProgram upscale;
+    GLint outputSizeLocation = -1;
+    GLint renderSizeLocation = -1;
+    GLint sharpnessLocation = -1;
+    GLuint emptyVAO = 0;
+};
+
+// (Re)allocates the target's attachments; the upscale program is kept
+inline bool resizeSceneTarget(SceneTarget& target, int width, int height)
+{
+    if (!target.fbo)
+    {
+        glGenFramebuffers(1, &target.fbo);
+        glGenTextures(1, &target.colorTexture);
+        glGenRenderbuffers(1, &target.depthBuffer);
+    }
+    target.width = width;
+    target.height = height;
+    target.renderWidth = width;
+    target.renderHeight = height;
+
+    glBindTexture(GL_TEXTURE_2D, target.colorTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, target.depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target.colorTexture, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, target.depthBuffer);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (!complete)
+        std::cerr << "Scene framebuffer is incomplete\n";
+    return complete;
+}
+
+inline bool createSceneTarget(SceneTarget& target, int width, int height, ProgramCache* cache = nullptr)
+{
+    target.upscale = createShaderProgram(kUpscaleVertexSource, kUpscaleFragmentSource, nullptr, cache);
+    glUseProgram(target.upscale.id);
+    glUniform1i(target.upscale.location("source"), 0);
+    glUseProgram(0);
+    target.outputSizeLocation = target.upscale.location("outputSize");
+    target.renderSizeLocation = target.upscale.location("renderSize");
+    target.sharpnessLocation = target.upscale.location("sharpness");
+    glGenVertexArrays(1, &target.emptyVAO);
+    return resizeSceneTarget(target, width, height);
+}
+
+// Binds the target with the viewport covering `scale` of it in each direction
+inline void beginSceneTarget(SceneTarget& target, float scale)
+{
+    target.renderWidth = std::max(1, std::min(target.width, (int)std::lround(target.width * scale)));
+    target.renderHeight = std::max(1, std::min(target.height, (int)std::lround(target.height * scale)));
+    glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+    glViewport(0, 0, target.renderWidth, target.renderHeight);
+}
+
+// Stretches the rendered area over the whole of `framebuffer`. Sharpening is skipped
+// at full resolution, where the pass is a plain copy.
+inline void upscaleSceneTarget(const SceneTarget& target, GLuint framebuffer, float sharpness)
+{
+    bool scaled = target.renderWidth != target.width || target.renderHeight != target.height;
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, target.width, target.height);
+    glDisable(GL_DEPTH_TEST);
+    glUseProgram(target.upscale.id);
+    glUniform2f(target.outputSizeLocation, (float)target.width, (float)target.height);
+    glUniform2f(target.renderSizeLocation, (float)target.renderWidth, (float)target.renderHeight);
+    glUniform1f(target.sharpnessLocation, scaled ? sharpness : 0.0f);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, target.colorTexture);
+    glBindVertexArray(target.emptyVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glEnable(GL_DEPTH_TEST);
+}
+
+inline void destroySceneTarget(SceneTarget& target)
+{
+    glDeleteFramebuffers(1, &target.fbo);
+    glDeleteTextures(1, &target.colorTexture);
+    glDeleteRenderbuffers(1, &target.depthBuffer);
+    glDeleteVertexArrays(1, &target.emptyVAO);
+    glDeleteProgram(target.upscale.id);
+    target = SceneTarget();
+}
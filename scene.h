@@ -0,0 +1,98 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <vector>
+
+// Transform hierarchy stored as parallel arrays indexed by node id. Nodes are
+// always added after their parent, so ascending id order is a valid top-down
+// order. World matrices live in one contiguous array and are only recomputed
+// for subtrees whose local transform changed since the last update.
+struct SceneGraph
+{
+    std::vector<int> parent;
+    std::vector<int> firstChild;
+    std::vector<int> nextSibling;
+    std::vector<glm::mat4> local;
+    std::vector<glm::mat4> world;
+    std::vector<unsigned char> dirty;
+    std::vector<int> dirtyNodes;
+    std::vector<int> updateStack;
+
+    void reserve(size_t nodeCount)
+    {
+        parent.reserve(nodeCount);
+        firstChild.reserve(nodeCount);
+        nextSibling.reserve(nodeCount);
+        local.reserve(nodeCount);
+        world.reserve(nodeCount);
+        dirty.reserve(nodeCount);
+    }
+
+    int addNode(int parentNode, const glm::mat4& localTransform)
+    {
+        int node = (int)parent.size();
+        parent.push_back(parentNode);
+        firstChild.push_back(-1);
+        nextSibling.push_back(-1);
+        local.push_back(localTransform);
+        world.push_back(parentNode >= 0 ? world[parentNode] * localTransform : localTransform);
+        dirty.push_back(0);
+
+        // Prepend to the parent's child list
+        if (parentNode >= 0)
+        {
+            nextSibling[node] = firstChild[parentNode];
+            firstChild[parentNode] = node;
+        }
+        return node;
+    }
+
+    void setLocal(int node, const glm::mat4& localTransform)
+    {
+        local[node] = localTransform;
+        if (!dirty[node])
+        {
+            dirty[node] = 1;
+            dirtyNodes.push_back(node);
+        }
+    }
+
+    // Recomputes world matrices of every dirty subtree. Static nodes are never touched.
+    void updateWorldTransforms()
+    {
+        if (dirtyNodes.empty())
+            return;
+
+        // Parents first, so a node already refreshed through a dirty ancestor is skipped
+        std::sort(dirtyNodes.begin(), dirtyNodes.end());
+        std::vector<int>& stack = updateStack;
+        for (int root : dirtyNodes)
+        {
+            if (!dirty[root])
+                continue;
+
+            stack.clear();
+            stack.push_back(root);
+            while (!stack.empty())
+            {
+                int node = stack.back();
+                stack.pop_back();
+
+                int parentNode = parent[node];
+                world[node] = parentNode >= 0 ? world[parentNode] * local[node] : local[node];
+                dirty[node] = 0;
+
+                for (int child = firstChild[node]; child >= 0; child = nextSibling[child])
+                    stack.push_back(child);
+            }
+        }
+        dirtyNodes.clear();
+    }
+};
+
+inline glm::mat4 translateScale(const glm::vec3& translation, const glm::vec3& scale)
+{
+    return glm::translate(glm::mat4(1.0f), translation) * glm::scale(glm::mat4(1.0f), scale);
+}
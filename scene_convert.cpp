@@ -0,0 +1,112 @@
+// Converts a JSON scene description to the binary scene format. Needs no OpenGL:
+//
+//     g++ -O2 scene_convert.cpp -o scene_convert
+//     ./scene_convert room.json room.scene
+//     ./scene_convert --grid 1000000 grid.scene
+//
+// --grid writes a synthetic scene of N small cubes and spheres filling the room,
+// a tenth of them orbiting, for measuring how large scenes load. The result is
+// read back and checked before the tool reports success.
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "scenejson.h"
+
+typedef std::chrono::steady_clock Clock;
+
+void buildGrid(SceneBuilder& scene, uint32_t count)
+{
+    SceneFileMaterial white = { { 0.9f, 0.9f, 0.9f }, kSceneNoString };
+    SceneFileMaterial moon = { { 0.6f, 0.6f, 0.6f }, scene.addString("moon.jpg") };
+    scene.materials.push_back(white);
+    scene.materials.push_back(moon);
+
+    scene.nodes.reserve(count + count / 10);
+    scene.objects.reserve(count);
+    uint32_t side = (uint32_t)std::ceil(std::sqrt((double)count));
+    float spacing = 28.0f / side;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        float x = -14.0f + spacing * (i % side + 0.5f);
+        float z = -14.0f + spacing * (i / side + 0.5f);
+        float size = spacing * 0.4f;
+        float local[16] = { size, 0, 0, 0, 0, size, 0, 0, 0, 0, size, 0, x, 0.0f, z, 1 };
+
+        // Every tenth object circles its grid cell
+        int32_t parent = -1;
+        if (i % 10 == 0)
+        {
+            float pivot[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, x, 0.0f, z, 1 };
+            parent = (int32_t)scene.addNode(-1, pivot);
+            scene.orbits.push_back({ (uint32_t)parent, spacing * 0.3f, 1.0f + (i % 7) * 0.25f, 0.5f });
+            local[12] = local[14] = 0.0f;
+        }
+        uint32_t node = scene.addNode(parent, local);
+        scene.objects.push_back({ node, i % 2 ? (uint32_t)SceneMeshSphere : (uint32_t)SceneMeshCube, i % 3 == 0 ? 1u : 0u });
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 3 && !(argc == 4 && std::string(argv[1]) == "--grid"))
+    {
+        fprintf(stderr, "Usage: %s input.json output.scene\n       %s --grid N output.scene\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    Clock::time_point start = Clock::now();
+    SceneBuilder builder;
+    std::string error;
+    std::string output = argv[argc - 1];
+    if (argc == 4)
+    {
+        buildGrid(builder, (uint32_t)std::max(0L, atol(argv[2])));
+    }
+    else
+    {
+        std::vector<unsigned char> source;
+        if (!readFile(argv[1], source))
+        {
+            fprintf(stderr, "Cannot read %s\n", argv[1]);
+            return 1;
+        }
+        if (!SceneJsonConverter().convert(std::string(source.begin(), source.end()), builder, error))
+        {
+            fprintf(stderr, "%s: %s\n", argv[1], error.c_str());
+            return 1;
+        }
+    }
+
+    std::vector<unsigned char> bytes = builder.serialize();
+    FILE* file = fopen(output.c_str(), "wb");
+    bool written = file && fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    written = file && fclose(file) == 0 && written;
+    if (!written)
+    {
+        fprintf(stderr, "Cannot write %s\n", output.c_str());
+        return 1;
+    }
+    double convertMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    // Read it back the way the renderer does
+    start = Clock::now();
+    SceneFile scene;
+    SceneChunk chunk;
+    bool valid = scene.open(output, error);
+    while (valid && !scene.done())
+        valid = scene.nextChunk(kSceneChunkNodes, chunk, error);
+    double loadMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    if (!valid)
+    {
+        fprintf(stderr, "%s: %s\n", output.c_str(), error.c_str());
+        return 1;
+    }
+
+    printf("%s: %zu nodes, %zu objects, %zu materials, %zu orbits, %zu KB in %.1f ms (read back in %.2f ms)\n",
+           output.c_str(), builder.nodes.size(), builder.objects.size(), builder.materials.size(), builder.orbits.size(),
+           bytes.size() / 1024, convertMs, loadMs);
+    return 0;
+}
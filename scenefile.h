@@ -0,0 +1,305 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "mappedfile.h"
+
+// Binary scene file (".scene"). Every table is a flat array of fixed-size records
+// at an offset from the start of the file, so a mapped file is read in place:
+//
+//     SceneFileHeader
+//     nodes      SceneFileNode[nodeCount]          parents come before their children
+//     objects    SceneFileObject[objectCount]      drawables, in node order
+//     materials  SceneFileMaterial[materialCount]
+//     orbits     SceneFileOrbit[orbitCount]        nodes whose translation is animated
+//     strings    null-terminated names, referenced by byte offset
+//
+// Each table starts on a 16-byte boundary. The header is checked when the file is
+// opened; records are checked as they are handed out by nextChunk(), so a large file
+// is never walked up front. scenejson.h converts the readable JSON description.
+
+enum SceneMesh : uint32_t
+{
+    SceneMeshCube = 0,
+    SceneMeshSphere = 1,
+    SceneMeshCount
+};
+
+struct SceneFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t nodeCount;
+    uint32_t objectCount;
+    uint32_t materialCount;
+    uint32_t orbitCount;
+    uint64_t nodeOffset;
+    uint64_t objectOffset;
+    uint64_t materialOffset;
+    uint64_t orbitOffset;
+    uint64_t stringOffset;
+    uint64_t stringSize;
+    uint32_t flags;       // SceneFlags
+    uint32_t reserved;
+};
+
+enum SceneFlags : uint32_t
+{
+    SceneFlagDepthPrepass = 1    // draw a depth-only pass before shading
+};
+
+struct SceneFileNode
+{
+    float local[16];    // column-major local transform
+    int32_t parent;     // -1 for a root
+    uint32_t reserved;
+};
+
+struct SceneFileObject
+{
+    uint32_t node;
+    uint32_t mesh;        // SceneMesh
+    uint32_t material;
+};
+
+struct SceneFileMaterial
+{
+    float color[3];     // used when there is no texture, or it failed to load
+    uint32_t texture;   // string offset, kSceneNoString for none
+};
+
+struct SceneFileOrbit
+{
+    uint32_t node;
+    float radius;
+    float speed;     // radians per second
+    float height;
+};
+
+const char kSceneMagic[4] = { 'S', 'C', 'N', 'E' };
+const uint32_t kSceneVersion = 2;
+const uint32_t kSceneNoString = 0xFFFFFFFFu;
+
+// Nodes handed out per nextChunk() while a scene streams in
+const uint32_t kSceneChunkNodes = 1 << 16;
+
+// Collects a scene in memory and lays it out as a scene file
+struct SceneBuilder
+{
+    std::vector<SceneFileNode> nodes;
+    std::vector<SceneFileObject> objects;
+    std::vector<SceneFileMaterial> materials;
+    std::vector<SceneFileOrbit> orbits;
+    std::string strings;
+    uint32_t flags = 0;
+
+    uint32_t addNode(int32_t parent, const float local[16])
+    {
+        SceneFileNode node = {};
+        std::memcpy(node.local, local, sizeof(node.local));
+        node.parent = parent;
+        nodes.push_back(node);
+        return (uint32_t)nodes.size() - 1;
+    }
+
+    uint32_t addString(const std::string& text)
+    {
+        uint32_t offset = (uint32_t)strings.size();
+        strings += text;
+        strings += '\0';
+        return offset;
+    }
+
+    std::vector<unsigned char> serialize() const
+    {
+        auto align = [](uint64_t value) { return (value + 15) & ~(uint64_t)15; };
+        SceneFileHeader header = {};
+        std::memcpy(header.magic, kSceneMagic, sizeof(kSceneMagic));
+        header.version = kSceneVersion;
+        header.flags = flags;
+        header.nodeCount = (uint32_t)nodes.size();
+        header.objectCount = (uint32_t)objects.size();
+        header.materialCount = (uint32_t)materials.size();
+        header.orbitCount = (uint32_t)orbits.size();
+        header.nodeOffset = align(sizeof(SceneFileHeader));
+        header.objectOffset = align(header.nodeOffset + nodes.size() * sizeof(SceneFileNode));
+        header.materialOffset = align(header.objectOffset + objects.size() * sizeof(SceneFileObject));
+        header.orbitOffset = align(header.materialOffset + materials.size() * sizeof(SceneFileMaterial));
+        header.stringOffset = align(header.orbitOffset + orbits.size() * sizeof(SceneFileOrbit));
+        header.stringSize = strings.size();
+
+        std::vector<unsigned char> bytes(header.stringOffset + header.stringSize);
+        auto copy = [&](uint64_t offset, const void* data, size_t size) {
+            if (size > 0)
+                std::memcpy(bytes.data() + offset, data, size);
+        };
+        copy(0, &header, sizeof(header));
+        copy(header.nodeOffset, nodes.data(), nodes.size() * sizeof(SceneFileNode));
+        copy(header.objectOffset, objects.data(), objects.size() * sizeof(SceneFileObject));
+        copy(header.materialOffset, materials.data(), materials.size() * sizeof(SceneFileMaterial));
+        copy(header.orbitOffset, orbits.data(), orbits.size() * sizeof(SceneFileOrbit));
+        copy(header.stringOffset, strings.data(), strings.size());
+        return bytes;
+    }
+};
+
+// Records handed out by one SceneFile::nextChunk() call
+struct SceneChunk
+{
+    uint32_t nodeBegin = 0;
+    uint32_t nodeEnd = 0;
+    uint32_t objectBegin = 0;
+    uint32_t objectEnd = 0;
+};
+
+// A scene file, mapped (or held in memory when converted on the fly). Materials and
+// orbits are small and checked in full by open(); nodes and objects stream in
+// through nextChunk(), which also asks the kernel to read the following chunk ahead.
+class SceneFile
+{
+public:
+    bool open(const std::string& path, std::string& error)
+    {
+        close();
+        if (!file.open(path))
+        {
+            error = "cannot open " + path;
+            return false;
+        }
+        bytes = file.data();
+        size = file.size();
+        return checkHeader(error);
+    }
+
+    bool openMemory(std::vector<unsigned char> data, std::string& error)
+    {
+        close();
+        memory = std::move(data);
+        bytes = memory.data();
+        size = memory.size();
+        return checkHeader(error);
+    }
+
+    void close()
+    {
+        file.close();
+        memory.clear();
+        bytes = nullptr;
+        size = 0;
+        chunk = SceneChunk();
+    }
+
+    const SceneFileHeader& header() const { return *(const SceneFileHeader*)bytes; }
+    const SceneFileNode* nodes() const { return (const SceneFileNode*)(bytes + header().nodeOffset); }
+    const SceneFileObject* objects() const { return (const SceneFileObject*)(bytes + header().objectOffset); }
+    const SceneFileMaterial* materials() const { return (const SceneFileMaterial*)(bytes + header().materialOffset); }
+    const SceneFileOrbit* orbits() const { return (const SceneFileOrbit*)(bytes + header().orbitOffset); }
+
+    // Name at a string offset checked by open(); nullptr for kSceneNoString
+    const char* string(uint32_t offset) const
+    {
+        return offset == kSceneNoString ? nullptr : (const char*)(bytes + header().stringOffset + offset);
+    }
+
+    size_t fileSize() const { return size; }
+    // True once everything has been handed out, or the file was closed
+    bool done() const { return !bytes || (chunk.nodeEnd == header().nodeCount && chunk.objectEnd == header().objectCount); }
+
+    // Hands out the next maxNodes nodes and every object attached to a node handed
+    // out so far. Fails on a record that points outside the file's tables.
+    bool nextChunk(uint32_t maxNodes, SceneChunk& next, std::string& error)
+    {
+        const SceneFileHeader& head = header();
+        next.nodeBegin = chunk.nodeEnd;
+        next.nodeEnd = next.nodeBegin + std::min(maxNodes, head.nodeCount - next.nodeBegin);
+        for (uint32_t i = next.nodeBegin; i < next.nodeEnd; ++i)
+        {
+            if (nodes()[i].parent < -1 || nodes()[i].parent >= (int32_t)i)
+            {
+                error = "node " + std::to_string(i) + " does not come after its parent";
+                return false;
+            }
+        }
+
+        next.objectBegin = chunk.objectEnd;
+        next.objectEnd = next.objectBegin;
+        while (next.objectEnd < head.objectCount && objects()[next.objectEnd].node < next.nodeEnd)
+        {
+            const SceneFileObject& object = objects()[next.objectEnd];
+            if (object.mesh >= SceneMeshCount || object.material >= head.materialCount)
+            {
+                error = "object " + std::to_string(next.objectEnd) + " has an unknown mesh or material";
+                return false;
+            }
+            ++next.objectEnd;
+        }
+        if (next.nodeEnd == head.nodeCount && next.objectEnd < head.objectCount)
+        {
+            error = "object " + std::to_string(next.objectEnd) + " is attached to a missing or earlier node";
+            return false;
+        }
+        chunk = next;
+
+        // Start reading the next chunk while this one is being used
+        file.prefetch(head.nodeOffset + (size_t)next.nodeEnd * sizeof(SceneFileNode), (size_t)maxNodes * sizeof(SceneFileNode));
+        file.prefetch(head.objectOffset + (size_t)next.objectEnd * sizeof(SceneFileObject), (size_t)maxNodes * sizeof(SceneFileObject));
+        return true;
+    }
+
+private:
+    bool checkHeader(std::string& error)
+    {
+        if (size < sizeof(SceneFileHeader) || std::memcmp(bytes, kSceneMagic, sizeof(kSceneMagic)) != 0)
+        {
+            error = "not a scene file";
+            return false;
+        }
+        const SceneFileHeader& head = header();
+        if (head.version != kSceneVersion)
+        {
+            error = "scene file version " + std::to_string(head.version) + ", expected " + std::to_string(kSceneVersion);
+            return false;
+        }
+        auto fits = [&](uint64_t offset, uint64_t count, uint64_t recordSize) {
+            return offset % 16 == 0 && offset <= size && count <= (size - offset) / recordSize;
+        };
+        if (!fits(head.nodeOffset, head.nodeCount, sizeof(SceneFileNode)) ||
+            !fits(head.objectOffset, head.objectCount, sizeof(SceneFileObject)) ||
+            !fits(head.materialOffset, head.materialCount, sizeof(SceneFileMaterial)) ||
+            !fits(head.orbitOffset, head.orbitCount, sizeof(SceneFileOrbit)) || !fits(head.stringOffset, head.stringSize, 1) ||
+            (head.stringSize > 0 && bytes[head.stringOffset + head.stringSize - 1] != 0))
+        {
+            error = "scene file is truncated or corrupt";
+            return false;
+        }
+        for (uint32_t i = 0; i < head.materialCount; ++i)
+        {
+            uint32_t texture = materials()[i].texture;
+            if (texture != kSceneNoString && texture >= head.stringSize)
+            {
+                error = "material " + std::to_string(i) + " has a bad texture name";
+                return false;
+            }
+        }
+        for (uint32_t i = 0; i < head.orbitCount; ++i)
+        {
+            if (orbits()[i].node >= head.nodeCount)
+            {
+                error = "orbit " + std::to_string(i) + " animates a missing node";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    MappedFile file;
+    std::vector<unsigned char> memory;
+    const unsigned char* bytes = nullptr;
+    size_t size = 0;
+    SceneChunk chunk;
+};
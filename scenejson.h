@@ -0,0 +1,406 @@
+#pragma once
+
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "scenefile.h"
+
+// Readable scene description, converted to the binary scene format:
+//
+//     {
+//         "depthPrepass": true,
+//         "materials": {
+//             "grass": { "color": [0, 1, 0], "texture": "grass.jpg" },
+//             "wall":  { "color": [0.529, 0.808, 0.922] }
+//         },
+//         "nodes": [
+//             { "translate": [0, -0.51, 0], "scale": [30, 0.02, 30], "mesh": "cube", "material": "grass" },
+//             { "orbit": { "radius": 5, "speed": 1, "height": 1 },
+//               "children": [ { "scale": [0.5, 0.5, 0.5], "mesh": "sphere", "material": "wall" } ] }
+//         ]
+//     }
+//
+// A node's local transform is "matrix" (16 numbers, column-major) or "translate"
+// followed by "scale". Nodes with a "mesh" are drawn with their "material"; nodes
+// with an "orbit" have their translation animated around their parent. Nodes are
+// written depth-first, so every parent precedes its children. "depthPrepass" turns
+// the depth pre-pass on for the scene (see overdraw.h).
+
+struct JsonValue
+{
+    enum Type
+    {
+        Null,
+        Bool,
+        Number,
+        String,
+        Array,
+        Object
+    };
+
+    Type type = Null;
+    bool boolean = false;
+    double number = 0.0;
+    std::string text;
+    std::vector<JsonValue> items;
+    std::vector<std::pair<std::string, JsonValue>> members;    // in file order
+
+    const JsonValue* find(const char* key) const
+    {
+        for (const std::pair<std::string, JsonValue>& member : members)
+        {
+            if (member.first == key)
+                return &member.second;
+        }
+        return nullptr;
+    }
+};
+
+// Recursive-descent JSON parser; errors carry the line they were found on
+class JsonParser
+{
+public:
+    bool parse(const std::string& source, JsonValue& value, std::string& error)
+    {
+        text = source.c_str();
+        position = text;
+        failure.clear();
+        if (parseValue(value, 0))
+        {
+            skipSpace();
+            if (*position != '\0')
+                fail("unexpected trailing characters");
+        }
+        if (failure.empty())
+            return true;
+        error = failure;
+        return false;
+    }
+
+private:
+    static const int kMaxDepth = 256;
+
+    bool fail(const char* message)
+    {
+        if (failure.empty())
+        {
+            int line = 1;
+            for (const char* p = text; p < position; ++p)
+                line += *p == '\n';
+            failure = "line " + std::to_string(line) + ": " + message;
+        }
+        return false;
+    }
+
+    void skipSpace()
+    {
+        while (*position == ' ' || *position == '\t' || *position == '\n' || *position == '\r')
+            ++position;
+    }
+
+    bool expect(char c)
+    {
+        skipSpace();
+        if (*position != c)
+            return fail(c == ':' ? "expected ':'" : c == ']' ? "expected ',' or ']'" : "expected ',' or '}'");
+        ++position;
+        return true;
+    }
+
+    bool parseValue(JsonValue& value, int depth)
+    {
+        if (depth > kMaxDepth)
+            return fail("nested too deeply");
+        skipSpace();
+        char c = *position;
+        if (c == '{')
+            return parseObject(value, depth);
+        if (c == '[')
+            return parseArray(value, depth);
+        if (c == '"')
+        {
+            value.type = JsonValue::String;
+            return parseString(value.text);
+        }
+        if (c == '-' || (c >= '0' && c <= '9'))
+        {
+            char* end;
+            value.type = JsonValue::Number;
+            value.number = strtod(position, &end);
+            if (end == position)
+                return fail("bad number");
+            position = end;
+            return true;
+        }
+        if (std::strncmp(position, "true", 4) == 0 || std::strncmp(position, "false", 5) == 0)
+        {
+            value.type = JsonValue::Bool;
+            value.boolean = c == 't';
+            position += value.boolean ? 4 : 5;
+            return true;
+        }
+        if (std::strncmp(position, "null", 4) == 0)
+        {
+            value.type = JsonValue::Null;
+            position += 4;
+            return true;
+        }
+        return fail("expected a value");
+    }
+
+    bool parseString(std::string& out)
+    {
+        ++position;
+        out.clear();
+        while (*position != '"')
+        {
+            if (*position == '\0' || *position == '\n')
+                return fail("unterminated string");
+            if (*position == '\\')
+            {
+                ++position;
+                switch (*position)
+                {
+                case 'n': out += '\n'; break;
+                case 't': out += '\t'; break;
+                case '"':
+                case '\\':
+                case '/': out += *position; break;
+                default: return fail("unsupported escape in string");
+                }
+                ++position;
+                continue;
+            }
+            out += *position++;
+        }
+        ++position;
+        return true;
+    }
+
+    bool parseArray(JsonValue& value, int depth)
+    {
+        value.type = JsonValue::Array;
+        ++position;
+        skipSpace();
+        if (*position == ']')
+        {
+            ++position;
+            return true;
+        }
+        for (;;)
+        {
+            value.items.emplace_back();
+            if (!parseValue(value.items.back(), depth + 1))
+                return false;
+            skipSpace();
+            if (*position == ']')
+            {
+                ++position;
+                return true;
+            }
+            if (!expect(','))
+                return false;
+        }
+    }
+
+    bool parseObject(JsonValue& value, int depth)
+    {
+        value.type = JsonValue::Object;
+        ++position;
+        skipSpace();
+        if (*position == '}')
+        {
+            ++position;
+            return true;
+        }
+        for (;;)
+        {
+            skipSpace();
+            if (*position != '"')
+                return fail("expected a member name");
+            value.members.emplace_back();
+            if (!parseString(value.members.back().first) || !expect(':') ||
+                !parseValue(value.members.back().second, depth + 1))
+                return false;
+            skipSpace();
+            if (*position == '}')
+            {
+                ++position;
+                return true;
+            }
+            if (!expect(','))
+                return false;
+        }
+    }
+
+    const char* text = nullptr;
+    const char* position = nullptr;
+    std::string failure;
+};
+
+// Reads `count` numbers from an array member; false if it is missing or malformed
+inline bool readJsonNumbers(const JsonValue* value, float* out, size_t count)
+{
+    if (!value || value->type != JsonValue::Array || value->items.size() != count)
+        return false;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (value->items[i].type != JsonValue::Number)
+            return false;
+        out[i] = (float)value->items[i].number;
+    }
+    return true;
+}
+
+class SceneJsonConverter
+{
+public:
+    bool convert(const std::string& source, SceneBuilder& scene, std::string& error)
+    {
+        JsonValue root;
+        if (!JsonParser().parse(source, root, error))
+            return false;
+        if (root.type != JsonValue::Object)
+            return fail("the top level must be an object", error);
+        const JsonValue* prepass = root.find("depthPrepass");
+        if (prepass && prepass->type == JsonValue::Bool && prepass->boolean)
+            scene.flags |= SceneFlagDepthPrepass;
+
+        if (const JsonValue* materials = root.find("materials"))
+        {
+            if (materials->type != JsonValue::Object)
+                return fail("\"materials\" must be an object", error);
+            for (const std::pair<std::string, JsonValue>& member : materials->members)
+            {
+                SceneFileMaterial material = {};
+                material.color[0] = material.color[1] = material.color[2] = 1.0f;
+                material.texture = kSceneNoString;
+                const JsonValue* color = member.second.find("color");
+                if (color && !readJsonNumbers(color, material.color, 3))
+                    return fail("material \"" + member.first + "\": \"color\" needs 3 numbers", error);
+                const JsonValue* texture = member.second.find("texture");
+                if (texture && texture->type == JsonValue::String)
+                    material.texture = scene.addString(texture->text);
+                materialIds[member.first] = (uint32_t)scene.materials.size();
+                scene.materials.push_back(material);
+            }
+        }
+
+        const JsonValue* nodes = root.find("nodes");
+        if (!nodes || nodes->type != JsonValue::Array)
+            return fail("\"nodes\" must be an array", error);
+        for (const JsonValue& node : nodes->items)
+        {
+            if (!addNode(node, -1, scene, error))
+                return false;
+        }
+        return true;
+    }
+
+private:
+    bool fail(const std::string& message, std::string& error)
+    {
+        error = message;
+        return false;
+    }
+
+    bool addNode(const JsonValue& node, int32_t parent, SceneBuilder& scene, std::string& error)
+    {
+        std::string where = "node " + std::to_string(scene.nodes.size());
+        if (node.type != JsonValue::Object)
+            return fail(where + " is not an object", error);
+
+        // Same layout as translateScale(): scale on the diagonal, translation in column 3
+        float local[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+        if (const JsonValue* matrix = node.find("matrix"))
+        {
+            if (!readJsonNumbers(matrix, local, 16))
+                return fail(where + ": \"matrix\" needs 16 numbers", error);
+        }
+        else
+        {
+            float translate[3] = { 0, 0, 0 };
+            float scale[3] = { 1, 1, 1 };
+            const JsonValue* translateValue = node.find("translate");
+            const JsonValue* scaleValue = node.find("scale");
+            if ((translateValue && !readJsonNumbers(translateValue, translate, 3)) ||
+                (scaleValue && !readJsonNumbers(scaleValue, scale, 3)))
+                return fail(where + ": \"translate\" and \"scale\" need 3 numbers", error);
+            local[0] = scale[0];
+            local[5] = scale[1];
+            local[10] = scale[2];
+            local[12] = translate[0];
+            local[13] = translate[1];
+            local[14] = translate[2];
+        }
+        uint32_t id = scene.addNode(parent, local);
+
+        if (const JsonValue* mesh = node.find("mesh"))
+        {
+            SceneFileObject object = {};
+            object.node = id;
+            if (mesh->type == JsonValue::String && mesh->text == "cube")
+                object.mesh = SceneMeshCube;
+            else if (mesh->type == JsonValue::String && mesh->text == "sphere")
+                object.mesh = SceneMeshSphere;
+            else
+                return fail(where + ": \"mesh\" must be \"cube\" or \"sphere\"", error);
+
+            const JsonValue* material = node.find("material");
+            auto found = material && material->type == JsonValue::String ? materialIds.find(material->text) : materialIds.end();
+            if (found == materialIds.end())
+                return fail(where + ": \"material\" must name an entry of \"materials\"", error);
+            object.material = found->second;
+            scene.objects.push_back(object);
+        }
+
+        if (const JsonValue* orbit = node.find("orbit"))
+        {
+            float values[3];
+            const JsonValue* fields[3] = { orbit->find("radius"), orbit->find("speed"), orbit->find("height") };
+            for (int i = 0; i < 3; ++i)
+            {
+                if (!fields[i] || fields[i]->type != JsonValue::Number)
+                    return fail(where + ": \"orbit\" needs \"radius\", \"speed\" and \"height\"", error);
+                values[i] = (float)fields[i]->number;
+            }
+            scene.orbits.push_back({ id, values[0], values[1], values[2] });
+        }
+
+        if (const JsonValue* children = node.find("children"))
+        {
+            if (children->type != JsonValue::Array)
+                return fail(where + ": \"children\" must be an array", error);
+            for (const JsonValue& child : children->items)
+            {
+                if (!addNode(child, (int32_t)id, scene, error))
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    std::map<std::string, uint32_t> materialIds;
+};
+
+// Opens a scene: ".json" descriptions are converted in memory, anything else is mapped
+inline bool openScene(const std::string& path, SceneFile& scene, std::string& error)
+{
+    if (path.size() < 5 || path.compare(path.size() - 5, 5, ".json") != 0)
+        return scene.open(path, error);
+
+    std::vector<unsigned char> bytes;
+    if (!readFile(path, bytes))
+    {
+        error = "cannot open " + path;
+        return false;
+    }
+    SceneBuilder builder;
+    if (!SceneJsonConverter().convert(std::string(bytes.begin(), bytes.end()), builder, error))
+        return false;
+    return scene.openMemory(builder.serialize(), error);
+}
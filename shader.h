@@ -0,0 +1,286 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hash.h"
+
+// Linked program plus every active uniform location, resolved once at link time
+// so nothing in the render loop has to look uniforms up by name.
+struct ShaderProgram
+{
+    GLuint id = 0;
+    std::unordered_map<std::string, GLint> locations;
+
+    GLint location(const char* name) const
+    {
+        auto it = locations.find(name);
+        if (it == locations.end())
+        {
+            std::cerr << "Uniform not active in program: " << name << std::endl;
+            return -1;
+        }
+        return it->second;
+    }
+};
+
+// Shader compilation. The optional header (#version line and shared declarations)
+// is passed as a separate source string ahead of the shader body.
+inline GLuint compileShader(GLenum type, const char* source, const char* header = nullptr)
+{
+    GLuint shader = glCreateShader(type);
+    const char* sources[2] = { header ? header : "", source };
+    glShaderSource(shader, 2, sources, nullptr);
+    glCompileShader(shader);
+
+    GLint success;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if (!success)
+    {
+        char infoLog[512];
+        glGetShaderInfoLog(shader, 512, nullptr, infoLog);
+        std::cerr << "Shader compilation error:\n" << infoLog << std::endl;
+    }
+    return shader;
+}
+
+inline void cacheUniformLocations(ShaderProgram& program)
+{
+    program.locations.clear();
+
+    GLint uniformCount = 0;
+    GLint maxNameLength = 0;
+    glGetProgramiv(program.id, GL_ACTIVE_UNIFORMS, &uniformCount);
+    glGetProgramiv(program.id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+
+    std::string name(maxNameLength, '\0');
+    for (GLint i = 0; i < uniformCount; ++i)
+    {
+        GLsizei length = 0;
+        GLint size = 0;
+        GLenum type = 0;
+        glGetActiveUniform(program.id, i, maxNameLength, &length, &size, &type, &name[0]);
+        std::string uniformName(name.data(), length);
+
+        // Members of uniform blocks have no location and are set through the buffer
+        GLint location = glGetUniformLocation(program.id, uniformName.c_str());
+        if (location < 0)
+            continue;
+
+        // Arrays are reported as "name[0]"; make them reachable as "name" too
+        program.locations[uniformName] = location;
+        size_t bracket = uniformName.find('[');
+        if (bracket != std::string::npos)
+            program.locations[uniformName.substr(0, bracket)] = location;
+    }
+}
+
+// On-disk cache of linked program binaries (glGetProgramBinary). Each program is
+// stored as "<directory>/<key>.bin", where the key hashes the shader sources with the
+// GL vendor, renderer and version strings, so a driver update invalidates it. Also
+// collects compile/link timings for the startup report.
+struct ProgramCache
+{
+    std::string directory;    // empty when the driver has no binary formats
+    std::string driver;
+    int programs = 0;
+    int hits = 0;
+    int misses = 0;
+    double compileMs = 0.0;
+    double linkMs = 0.0;
+    double loadMs = 0.0;
+};
+
+struct ProgramBinaryHeader
+{
+    char magic[4];
+    uint32_t format;
+    uint64_t key;
+    uint32_t length;
+};
+
+const char kProgramBinaryMagic[4] = { 'P', 'B', 'I', 'N' };
+
+// Enables the cache in `directory` (created if missing) when the driver can export
+// program binaries. Needs a current context.
+inline void initProgramCache(ProgramCache& cache, const std::string& directory)
+{
+    cache = ProgramCache();
+    GLint formats = 0;
+    if (GLEW_ARB_get_program_binary)
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    if (formats <= 0 || directory.empty())
+        return;
+    mkdir(directory.c_str(), 0755);
+
+    const char* strings[3] = { (const char*)glGetString(GL_VENDOR), (const char*)glGetString(GL_RENDERER),
+                               (const char*)glGetString(GL_VERSION) };
+    for (const char* value : strings)
+    {
+        cache.driver += value ? value : "";
+        cache.driver += '\n';
+    }
+    cache.directory = directory;
+}
+
+inline uint64_t programCacheKey(const ProgramCache& cache, const char* vertexSource, const char* fragmentSource, const char* header)
+{
+    // The terminating zeros keep "ab" + "c" and "a" + "bc" apart
+    uint64_t key = hashBytes(cache.driver.c_str(), cache.driver.size() + 1);
+    key = hashBytes(header ? header : "", header ? strlen(header) + 1 : 1, key);
+    key = hashBytes(vertexSource, strlen(vertexSource) + 1, key);
+    return hashBytes(fragmentSource, strlen(fragmentSource) + 1, key);
+}
+
+inline std::string programCachePath(const ProgramCache& cache, uint64_t key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+    return cache.directory + "/" + name;
+}
+
+// Creates a program from a cached binary; returns 0 when there is no usable entry
+inline GLuint loadProgramBinary(const ProgramCache& cache, uint64_t key)
+{
+    FILE* file = fopen(programCachePath(cache, key).c_str(), "rb");
+    if (!file)
+        return 0;
+    ProgramBinaryHeader header;
+    std::vector<char> binary;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, kProgramBinaryMagic, 4) == 0 &&
+                 header.key == key && header.length > 0;
+    if (valid)
+    {
+        binary.resize(header.length);
+        valid = fread(binary.data(), 1, binary.size(), file) == binary.size();
+    }
+    fclose(file);
+    if (!valid)
+        return 0;
+
+    // The driver may still reject a binary, e.g. after a change it does not report in its strings
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, header.format, binary.data(), (GLsizei)binary.size());
+    GLint success = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+inline void storeProgramBinary(const ProgramCache& cache, uint64_t key, GLuint program)
+{
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+    ProgramBinaryHeader header;
+    memcpy(header.magic, kProgramBinaryMagic, 4);
+    header.key = key;
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    GLsizei written = 0;
+    glGetProgramBinary(program, length, &written, &format, binary.data());
+    if (written <= 0)
+        return;
+    header.format = format;
+    header.length = (uint32_t)written;
+
+    // Write then rename, so a concurrent run never reads half a binary
+    std::string path = programCachePath(cache, key);
+    std::string temporaryPath = path + ".tmp" + std::to_string((long)getpid());
+    FILE* file = fopen(temporaryPath.c_str(), "wb");
+    if (!file)
+        return;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(binary.data(), 1, written, file) == (size_t)written;
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(temporaryPath.c_str(), path.c_str()) != 0)
+        remove(temporaryPath.c_str());
+}
+
+// Compiles and links a program, or loads it from `cache` when one is given and holds
+// a binary for exactly these sources on this driver
+inline ShaderProgram createShaderProgram(const char* vertexSource, const char* fragmentSource, const char* header = nullptr,
+                                         ProgramCache* cache = nullptr)
+{
+    typedef std::chrono::steady_clock Clock;
+    auto milliseconds = [](Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    };
+
+    ShaderProgram program;
+    if (cache)
+        ++cache->programs;
+    bool cached = cache && !cache->directory.empty();
+    uint64_t key = cached ? programCacheKey(*cache, vertexSource, fragmentSource, header) : 0;
+    if (cached)
+    {
+        Clock::time_point start = Clock::now();
+        program.id = loadProgramBinary(*cache, key);
+        if (program.id)
+        {
+            cache->loadMs += milliseconds(start);
+            ++cache->hits;
+            cacheUniformLocations(program);
+            return program;
+        }
+        ++cache->misses;
+    }
+
+    Clock::time_point compileStart = Clock::now();
+    GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexSource, header);
+    GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentSource, header);
+    double compileMs = milliseconds(compileStart);
+
+    Clock::time_point linkStart = Clock::now();
+    program.id = glCreateProgram();
+    glAttachShader(program.id, vertexShader);
+    glAttachShader(program.id, fragmentShader);
+    if (cached)
+        glProgramParameteri(program.id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(program.id);
+
+    GLint success;
+    glGetProgramiv(program.id, GL_LINK_STATUS, &success);
+    double linkMs = milliseconds(linkStart);
+    if (!success)
+    {
+        char infoLog[512];
+        glGetProgramInfoLog(program.id, 512, nullptr, infoLog);
+        std::cerr << "Program linking error:\n" << infoLog << std::endl;
+    }
+    else if (cached)
+    {
+        storeProgramBinary(*cache, key, program.id);
+    }
+    if (cache)
+    {
+        cache->compileMs += compileMs;
+        cache->linkMs += linkMs;
+    }
+
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+
+    cacheUniformLocations(program);
+    return program;
+}
+
+// Attaches a named std140 uniform block to a fixed binding point, if the program uses it
+inline void bindUniformBlock(const ShaderProgram& program, const char* blockName, GLuint bindingPoint)
+{
+    GLuint blockIndex = glGetUniformBlockIndex(program.id, blockName);
+    if (blockIndex != GL_INVALID_INDEX)
+        glUniformBlockBinding(program.id, blockIndex, bindingPoint);
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+#include "profiler.h"
+
+// Lock-free single-writer, single-reader triple buffer. The writer fills
+// writeBuffer() and publishes it; the reader picks up the newest published value
+// with update() and reads it through readBuffer() until its next update(). Neither
+// side ever waits for the other, and the reader never sees a half-written value.
+template <typename T>
+class TripleBuffer
+{
+public:
+    T& writeBuffer() { return slots[back]; }
+
+    void publish()
+    {
+        back = middle.exchange(back | kFresh, std::memory_order_acq_rel) & kIndexMask;
+    }
+
+    // Returns true when a newer value was published since the last call
+    bool update()
+    {
+        if (!(middle.load(std::memory_order_relaxed) & kFresh))
+            return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & kIndexMask;
+        return true;
+    }
+
+    const T& readBuffer() const { return slots[front]; }
+
+private:
+    static const int kIndexMask = 3;
+    static const int kFresh = 4;
+
+    T slots[3];
+    int back = 0;     // writer only
+    int front = 1;    // reader only
+    std::atomic<int> middle{2};
+};
+
+// Runs a simulation at a fixed tick rate and publishes each tick's state through a
+// triple buffer, together with the state of the tick before, so the renderer can
+// interpolate between the two for any time in between. start() ticks on a thread of
+// its own in real time; without it, advanceTo() runs the ticks on the calling thread
+// (bench and replay runs, which must be deterministic).
+//
+// Tick k happens at time k * tickSeconds. Tick 0 sets up the initial state and is
+// passed dt = 0.
+template <typename State>
+class SimulationThread
+{
+public:
+    struct Snapshot
+    {
+        State previous;
+        State current;
+        double previousTime = 0.0;
+        double time = 0.0;
+        uint64_t tick = 0;
+    };
+
+    typedef std::function<void(double time, double dt, State& state)> TickFunction;
+
+    // Ticks that may be run back to back after a stall before the clock is reset
+    static const int kMaxCatchUpTicks = 5;
+
+    SimulationThread(double tickSeconds, TickFunction tick) : tickSeconds(tickSeconds), tickFunction(tick) {}
+
+    ~SimulationThread() { stop(); }
+
+    SimulationThread(const SimulationThread&) = delete;
+    SimulationThread& operator=(const SimulationThread&) = delete;
+
+    void start()
+    {
+        running = true;
+        startTime = Clock::now().time_since_epoch().count();
+        thread = std::thread([this] { threadLoop(); });
+    }
+
+    void stop()
+    {
+        running = false;
+        if (thread.joinable())
+            thread.join();
+    }
+
+    // Runs every tick up to and including `time` on the calling thread
+    void advanceTo(double time)
+    {
+        while (nextTick * tickSeconds <= time + tickSeconds * 1e-6)
+            runTick();
+    }
+
+    // Newest published snapshot; never blocks
+    const Snapshot& latest()
+    {
+        snapshots.update();
+        return snapshots.readBuffer();
+    }
+
+    // Real time since start(), on the simulation clock
+    double elapsed() const
+    {
+        return std::chrono::duration<double>(Clock::now() - origin()).count();
+    }
+
+    // Blend factor from snapshot.previous to snapshot.current for a render time
+    static float blendFactor(const Snapshot& snapshot, double time)
+    {
+        if (snapshot.time <= snapshot.previousTime)
+            return 1.0f;
+        double alpha = (time - snapshot.previousTime) / (snapshot.time - snapshot.previousTime);
+        return (float)std::min(1.0, std::max(0.0, alpha));
+    }
+
+    const double tickSeconds;
+    std::atomic<uint64_t> droppedTicks{0};    // skipped after stalls longer than kMaxCatchUpTicks
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    Clock::time_point origin() const
+    {
+        return Clock::time_point(Clock::duration(startTime.load(std::memory_order_relaxed)));
+    }
+
+    void runTick()
+    {
+        ProfileZone zone("simulation.tick");
+        double time = nextTick * tickSeconds;
+        tickFunction(time, nextTick == 0 ? 0.0 : tickSeconds, working);
+
+        Snapshot& snapshot = snapshots.writeBuffer();
+        snapshot.previous = nextTick == 0 ? working : previous;
+        snapshot.current = working;
+        snapshot.previousTime = nextTick == 0 ? time : time - tickSeconds;
+        snapshot.time = time;
+        snapshot.tick = nextTick;
+        snapshots.publish();
+        previous = working;
+        ++nextTick;
+    }
+
+    void threadLoop()
+    {
+        Clock::duration tick = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(tickSeconds));
+        while (running)
+        {
+            Clock::time_point deadline = origin() + tick * (int64_t)nextTick;
+            Clock::time_point now = Clock::now();
+            if (now < deadline)
+            {
+                std::this_thread::sleep_until(deadline);
+                continue;
+            }
+            // Too far behind to catch up: drop the backlog and shift the clock instead
+            int64_t behind = (now - deadline) / tick;
+            if (behind > kMaxCatchUpTicks)
+            {
+                droppedTicks += (uint64_t)behind;
+                startTime += (tick * behind).count();
+            }
+            runTick();
+        }
+    }
+
+    TickFunction tickFunction;
+    State working;
+    State previous;
+    uint64_t nextTick = 0;
+    TripleBuffer<Snapshot> snapshots;
+
+    std::thread thread;
+    std::atomic<bool> running{false};
+    std::atomic<Clock::rep> startTime{Clock::now().time_since_epoch().count()};    // moved forward after stalls
+};
@@ -0,0 +1,625 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include "threadpool.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+#include <immintrin.h>
+#define SIMULATION_X86 1
+#endif
+
+// Orbital simulation for large body populations, independent of OpenGL.
+//
+// Body state is kept as a structure of arrays so the update kernels stream
+// through memory and vectorize. Two modes are available:
+//   SimulationKepler  - closed-form Keplerian orbits around the central body,
+//                       evaluated directly from time (SSE2/AVX2/scalar kernels)
+//   SimulationGravity - N-body gravity with a Barnes-Hut octree, O(N log N),
+//                       integrated with a fixed timestep
+// Large populations are split across a ThreadPool.
+
+enum SimulationMode
+{
+    SimulationKepler,
+    SimulationGravity
+};
+
+enum SimdLevel
+{
+    SimdScalar,
+    SimdSSE2,
+    SimdAVX2
+};
+
+inline const char* simdLevelName(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdAVX2: return "avx2";
+    case SimdSSE2: return "sse2";
+    default: return "scalar";
+    }
+}
+
+inline SimdLevel detectSimdLevel()
+{
+#if defined(SIMULATION_X86) && (defined(__GNUC__) || defined(__clang__))
+    if (__builtin_cpu_supports("avx2"))
+        return SimdAVX2;
+    return SimdSSE2;
+#elif defined(SIMULATION_X86)
+    return SimdSSE2;
+#else
+    return SimdScalar;
+#endif
+}
+
+// Structure-of-arrays body state
+struct BodyArrays
+{
+    // Orbit elements (Kepler mode, and initial conditions for gravity mode)
+    std::vector<float> semiMajor;
+    std::vector<float> semiMinor;
+    std::vector<float> eccentricity;
+    std::vector<float> meanMotion;
+    std::vector<float> phase;
+    std::vector<float> height;
+
+    // Current positions, written by both modes
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+
+    // Gravity mode state
+    std::vector<float> vx;
+    std::vector<float> vy;
+    std::vector<float> vz;
+    std::vector<float> mass;
+
+    size_t size() const { return x.size(); }
+};
+
+// ---------------------------------------------------------------------------
+// Kepler kernels. Each evaluates bodies [begin, end) at the given time:
+//   M = n t + phase, E - e sin E = M (Newton iterations when any e > 0),
+//   x = b sin E, z = a (cos E - e), y = height
+// so a circular orbit reduces to x = r sin(M), z = r cos(M).
+
+const int kKeplerIterations = 3;
+
+inline void keplerScalar(BodyArrays& b, size_t begin, size_t end, float time, bool eccentric)
+{
+    for (size_t i = begin; i < end; ++i)
+    {
+        float meanAnomaly = b.meanMotion[i] * time + b.phase[i];
+        float e = b.eccentricity[i];
+        float anomaly = meanAnomaly;
+        if (eccentric)
+        {
+            for (int k = 0; k < kKeplerIterations; ++k)
+                anomaly -= (anomaly - e * std::sin(anomaly) - meanAnomaly) / (1.0f - e * std::cos(anomaly));
+        }
+        b.x[i] = b.semiMinor[i] * std::sin(anomaly);
+        b.y[i] = b.height[i];
+        b.z[i] = b.semiMajor[i] * (std::cos(anomaly) - e);
+    }
+}
+
+#ifdef SIMULATION_X86
+
+// Cephes-style single precision sincos: reduce to [-pi/4, pi/4] by octant and
+// evaluate the sine and cosine minimax polynomials. Accurate to a few ulp for
+// |x| < 8192.
+namespace simd_constants
+{
+    const float kFourOverPi = 1.27323954473516f;
+    const float kDP1 = -0.78515625f;
+    const float kDP2 = -2.4187564849853515625e-4f;
+    const float kDP3 = -3.77489497744594108e-8f;
+    const float kSin0 = -1.9515295891e-4f;
+    const float kSin1 = 8.3321608736e-3f;
+    const float kSin2 = -1.6666654611e-1f;
+    const float kCos0 = 2.443315711809948e-5f;
+    const float kCos1 = -1.388731625493765e-3f;
+    const float kCos2 = 4.166664568298827e-2f;
+}
+
+inline void sincosSSE2(__m128 x, __m128* s, __m128* c)
+{
+    using namespace simd_constants;
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    __m128 signSin = _mm_and_ps(x, signMask);
+    x = _mm_andnot_ps(signMask, x);
+
+    // Octant index rounded up to even
+    __m128i j = _mm_cvttps_epi32(_mm_mul_ps(x, _mm_set1_ps(kFourOverPi)));
+    j = _mm_and_si128(_mm_add_epi32(j, _mm_set1_epi32(1)), _mm_set1_epi32(~1));
+    __m128 y = _mm_cvtepi32_ps(j);
+
+    __m128 swapSignSin = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(j, _mm_set1_epi32(4)), 29));
+    __m128 polyMask = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(j, _mm_set1_epi32(2)), _mm_setzero_si128()));
+    __m128 signCos = _mm_castsi128_ps(_mm_slli_epi32(_mm_andnot_si128(_mm_sub_epi32(j, _mm_set1_epi32(2)), _mm_set1_epi32(4)), 29));
+    signSin = _mm_xor_ps(signSin, swapSignSin);
+
+    // Extended precision reduction x - y * pi/4
+    x = _mm_add_ps(x, _mm_mul_ps(y, _mm_set1_ps(kDP1)));
+    x = _mm_add_ps(x, _mm_mul_ps(y, _mm_set1_ps(kDP2)));
+    x = _mm_add_ps(x, _mm_mul_ps(y, _mm_set1_ps(kDP3)));
+    __m128 z = _mm_mul_ps(x, x);
+
+    __m128 cosPoly = _mm_set1_ps(kCos0);
+    cosPoly = _mm_add_ps(_mm_mul_ps(cosPoly, z), _mm_set1_ps(kCos1));
+    cosPoly = _mm_add_ps(_mm_mul_ps(cosPoly, z), _mm_set1_ps(kCos2));
+    cosPoly = _mm_mul_ps(_mm_mul_ps(cosPoly, z), z);
+    cosPoly = _mm_sub_ps(cosPoly, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+    cosPoly = _mm_add_ps(cosPoly, _mm_set1_ps(1.0f));
+
+    __m128 sinPoly = _mm_set1_ps(kSin0);
+    sinPoly = _mm_add_ps(_mm_mul_ps(sinPoly, z), _mm_set1_ps(kSin1));
+    sinPoly = _mm_add_ps(_mm_mul_ps(sinPoly, z), _mm_set1_ps(kSin2));
+    sinPoly = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(sinPoly, z), x), x);
+
+    __m128 sinResult = _mm_or_ps(_mm_and_ps(polyMask, sinPoly), _mm_andnot_ps(polyMask, cosPoly));
+    __m128 cosResult = _mm_or_ps(_mm_and_ps(polyMask, cosPoly), _mm_andnot_ps(polyMask, sinPoly));
+    *s = _mm_xor_ps(sinResult, signSin);
+    *c = _mm_xor_ps(cosResult, signCos);
+}
+
+inline void keplerSSE2(BodyArrays& b, size_t begin, size_t end, float time, bool eccentric)
+{
+    const __m128 t = _mm_set1_ps(time);
+    const __m128 one = _mm_set1_ps(1.0f);
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4)
+    {
+        __m128 meanAnomaly = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&b.meanMotion[i]), t), _mm_loadu_ps(&b.phase[i]));
+        __m128 e = _mm_loadu_ps(&b.eccentricity[i]);
+        __m128 anomaly = meanAnomaly;
+        __m128 s, c;
+        if (eccentric)
+        {
+            for (int k = 0; k < kKeplerIterations; ++k)
+            {
+                sincosSSE2(anomaly, &s, &c);
+                __m128 f = _mm_sub_ps(_mm_sub_ps(anomaly, _mm_mul_ps(e, s)), meanAnomaly);
+                __m128 df = _mm_sub_ps(one, _mm_mul_ps(e, c));
+                anomaly = _mm_sub_ps(anomaly, _mm_div_ps(f, df));
+            }
+        }
+        sincosSSE2(anomaly, &s, &c);
+        _mm_storeu_ps(&b.x[i], _mm_mul_ps(_mm_loadu_ps(&b.semiMinor[i]), s));
+        _mm_storeu_ps(&b.y[i], _mm_loadu_ps(&b.height[i]));
+        _mm_storeu_ps(&b.z[i], _mm_mul_ps(_mm_loadu_ps(&b.semiMajor[i]), _mm_sub_ps(c, e)));
+    }
+    keplerScalar(b, i, end, time, eccentric);
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SIMULATION_AVX2 1
+#define SIMULATION_TARGET_AVX2 __attribute__((target("avx2")))
+
+SIMULATION_TARGET_AVX2 inline void sincosAVX2(__m256 x, __m256* s, __m256* c)
+{
+    using namespace simd_constants;
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    __m256 signSin = _mm256_and_ps(x, signMask);
+    x = _mm256_andnot_ps(signMask, x);
+
+    __m256i j = _mm256_cvttps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(kFourOverPi)));
+    j = _mm256_and_si256(_mm256_add_epi32(j, _mm256_set1_epi32(1)), _mm256_set1_epi32(~1));
+    __m256 y = _mm256_cvtepi32_ps(j);
+
+    __m256 swapSignSin = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(j, _mm256_set1_epi32(4)), 29));
+    __m256 polyMask = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(j, _mm256_set1_epi32(2)), _mm256_setzero_si256()));
+    __m256 signCos = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_andnot_si256(_mm256_sub_epi32(j, _mm256_set1_epi32(2)), _mm256_set1_epi32(4)), 29));
+    signSin = _mm256_xor_ps(signSin, swapSignSin);
+
+    x = _mm256_add_ps(x, _mm256_mul_ps(y, _mm256_set1_ps(kDP1)));
+    x = _mm256_add_ps(x, _mm256_mul_ps(y, _mm256_set1_ps(kDP2)));
+    x = _mm256_add_ps(x, _mm256_mul_ps(y, _mm256_set1_ps(kDP3)));
+    __m256 z = _mm256_mul_ps(x, x);
+
+    __m256 cosPoly = _mm256_set1_ps(kCos0);
+    cosPoly = _mm256_add_ps(_mm256_mul_ps(cosPoly, z), _mm256_set1_ps(kCos1));
+    cosPoly = _mm256_add_ps(_mm256_mul_ps(cosPoly, z), _mm256_set1_ps(kCos2));
+    cosPoly = _mm256_mul_ps(_mm256_mul_ps(cosPoly, z), z);
+    cosPoly = _mm256_sub_ps(cosPoly, _mm256_mul_ps(z, _mm256_set1_ps(0.5f)));
+    cosPoly = _mm256_add_ps(cosPoly, _mm256_set1_ps(1.0f));
+
+    __m256 sinPoly = _mm256_set1_ps(kSin0);
+    sinPoly = _mm256_add_ps(_mm256_mul_ps(sinPoly, z), _mm256_set1_ps(kSin1));
+    sinPoly = _mm256_add_ps(_mm256_mul_ps(sinPoly, z), _mm256_set1_ps(kSin2));
+    sinPoly = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(sinPoly, z), x), x);
+
+    __m256 sinResult = _mm256_blendv_ps(cosPoly, sinPoly, polyMask);
+    __m256 cosResult = _mm256_blendv_ps(sinPoly, cosPoly, polyMask);
+    *s = _mm256_xor_ps(sinResult, signSin);
+    *c = _mm256_xor_ps(cosResult, signCos);
+}
+
+SIMULATION_TARGET_AVX2 inline void keplerAVX2(BodyArrays& b, size_t begin, size_t end, float time, bool eccentric)
+{
+    const __m256 t = _mm256_set1_ps(time);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8)
+    {
+        __m256 meanAnomaly = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(&b.meanMotion[i]), t), _mm256_loadu_ps(&b.phase[i]));
+        __m256 e = _mm256_loadu_ps(&b.eccentricity[i]);
+        __m256 anomaly = meanAnomaly;
+        __m256 s, c;
+        if (eccentric)
+        {
+            for (int k = 0; k < kKeplerIterations; ++k)
+            {
+                sincosAVX2(anomaly, &s, &c);
+                __m256 f = _mm256_sub_ps(_mm256_sub_ps(anomaly, _mm256_mul_ps(e, s)), meanAnomaly);
+                __m256 df = _mm256_sub_ps(one, _mm256_mul_ps(e, c));
+                anomaly = _mm256_sub_ps(anomaly, _mm256_div_ps(f, df));
+            }
+        }
+        sincosAVX2(anomaly, &s, &c);
+        _mm256_storeu_ps(&b.x[i], _mm256_mul_ps(_mm256_loadu_ps(&b.semiMinor[i]), s));
+        _mm256_storeu_ps(&b.y[i], _mm256_loadu_ps(&b.height[i]));
+        _mm256_storeu_ps(&b.z[i], _mm256_mul_ps(_mm256_loadu_ps(&b.semiMajor[i]), _mm256_sub_ps(c, e)));
+    }
+    keplerSSE2(b, i, end, time, eccentric);
+}
+#endif // __GNUC__ || __clang__
+
+#endif // SIMULATION_X86
+
+inline void keplerKernel(SimdLevel level, BodyArrays& b, size_t begin, size_t end, float time, bool eccentric)
+{
+#ifdef SIMULATION_AVX2
+    if (level == SimdAVX2)
+    {
+        keplerAVX2(b, begin, end, time, eccentric);
+        return;
+    }
+#endif
+#ifdef SIMULATION_X86
+    if (level >= SimdSSE2)
+    {
+        keplerSSE2(b, begin, end, time, eccentric);
+        return;
+    }
+#endif
+    keplerScalar(b, begin, end, time, eccentric);
+}
+
+// ---------------------------------------------------------------------------
+// Barnes-Hut octree. Nodes are built top-down by partitioning the body index
+// array into octants, so every node covers a contiguous index range and the
+// children of a node are stored next to each other.
+
+const int kOctreeLeafSize = 8;
+const int kOctreeMaxDepth = 24;
+
+struct OctreeNode
+{
+    float centerX, centerY, centerZ, halfSize;
+    float mass, comX, comY, comZ;
+    int firstChild;   // index of the first child, -1 for leaves
+    int childCount;
+    int firstBody;    // range into Octree::order
+    int bodyCount;
+};
+
+struct Octree
+{
+    std::vector<OctreeNode> nodes;
+    std::vector<int> order;
+    std::vector<int> scratch;
+
+    void build(const BodyArrays& b)
+    {
+        size_t count = b.size();
+        nodes.clear();
+        order.resize(count);
+        scratch.resize(count);
+        for (size_t i = 0; i < count; ++i)
+            order[i] = (int)i;
+        if (count == 0)
+            return;
+
+        float minX = b.x[0], minY = b.y[0], minZ = b.z[0];
+        float maxX = minX, maxY = minY, maxZ = minZ;
+        for (size_t i = 1; i < count; ++i)
+        {
+            minX = std::min(minX, b.x[i]); maxX = std::max(maxX, b.x[i]);
+            minY = std::min(minY, b.y[i]); maxY = std::max(maxY, b.y[i]);
+            minZ = std::min(minZ, b.z[i]); maxZ = std::max(maxZ, b.z[i]);
+        }
+        float halfSize = 0.5f * std::max(maxX - minX, std::max(maxY - minY, maxZ - minZ)) + 1e-3f;
+
+        nodes.reserve(count / 2 + 16);
+        nodes.push_back(OctreeNode());
+        OctreeNode& root = nodes[0];
+        root.centerX = 0.5f * (minX + maxX);
+        root.centerY = 0.5f * (minY + maxY);
+        root.centerZ = 0.5f * (minZ + maxZ);
+        root.halfSize = halfSize;
+        buildNode(b, 0, 0, (int)count, 0);
+    }
+
+    void buildNode(const BodyArrays& b, int nodeIndex, int begin, int end, int depth)
+    {
+        OctreeNode node = nodes[nodeIndex];
+        node.firstBody = begin;
+        node.bodyCount = end - begin;
+        node.firstChild = -1;
+        node.childCount = 0;
+
+        if (end - begin <= kOctreeLeafSize || depth >= kOctreeMaxDepth)
+        {
+            float mass = 0.0f, cx = 0.0f, cy = 0.0f, cz = 0.0f;
+            for (int k = begin; k < end; ++k)
+            {
+                int i = order[k];
+                mass += b.mass[i];
+                cx += b.mass[i] * b.x[i];
+                cy += b.mass[i] * b.y[i];
+                cz += b.mass[i] * b.z[i];
+            }
+            node.mass = mass;
+            float inv = mass > 0.0f ? 1.0f / mass : 0.0f;
+            node.comX = cx * inv;
+            node.comY = cy * inv;
+            node.comZ = cz * inv;
+            nodes[nodeIndex] = node;
+            return;
+        }
+
+        // Counting sort of the range into the eight octants
+        int counts[8] = {};
+        for (int k = begin; k < end; ++k)
+            ++counts[octant(node, b, order[k])];
+        int offsets[8];
+        int running = begin;
+        for (int o = 0; o < 8; ++o)
+        {
+            offsets[o] = running;
+            running += counts[o];
+        }
+        int cursor[8];
+        std::copy(offsets, offsets + 8, cursor);
+        for (int k = begin; k < end; ++k)
+            scratch[cursor[octant(node, b, order[k])]++] = order[k];
+        std::copy(scratch.begin() + begin, scratch.begin() + end, order.begin() + begin);
+
+        // Allocate the non-empty children contiguously, then recurse
+        node.firstChild = (int)nodes.size();
+        float quarter = node.halfSize * 0.5f;
+        for (int o = 0; o < 8; ++o)
+        {
+            if (counts[o] == 0)
+                continue;
+            OctreeNode child = OctreeNode();
+            child.centerX = node.centerX + ((o & 1) ? quarter : -quarter);
+            child.centerY = node.centerY + ((o & 2) ? quarter : -quarter);
+            child.centerZ = node.centerZ + ((o & 4) ? quarter : -quarter);
+            child.halfSize = quarter;
+            nodes.push_back(child);
+            ++node.childCount;
+        }
+        nodes[nodeIndex] = node;
+
+        int child = node.firstChild;
+        for (int o = 0; o < 8; ++o)
+        {
+            if (counts[o] == 0)
+                continue;
+            buildNode(b, child++, offsets[o], offsets[o] + counts[o], depth + 1);
+        }
+
+        // Aggregate mass and centre of mass from the children
+        float mass = 0.0f, cx = 0.0f, cy = 0.0f, cz = 0.0f;
+        for (int c = node.firstChild; c < node.firstChild + node.childCount; ++c)
+        {
+            const OctreeNode& n = nodes[c];
+            mass += n.mass;
+            cx += n.mass * n.comX;
+            cy += n.mass * n.comY;
+            cz += n.mass * n.comZ;
+        }
+        OctreeNode& stored = nodes[nodeIndex];
+        stored.mass = mass;
+        float inv = mass > 0.0f ? 1.0f / mass : 0.0f;
+        stored.comX = cx * inv;
+        stored.comY = cy * inv;
+        stored.comZ = cz * inv;
+    }
+
+    static int octant(const OctreeNode& node, const BodyArrays& b, int i)
+    {
+        return (b.x[i] >= node.centerX ? 1 : 0) | (b.y[i] >= node.centerY ? 2 : 0) | (b.z[i] >= node.centerZ ? 4 : 0);
+    }
+};
+
+// ---------------------------------------------------------------------------
+
+struct OrbitalSimulation
+{
+    SimulationMode mode = SimulationKepler;
+    SimdLevel simdLevel = detectSimdLevel();
+    ThreadPool* pool = nullptr;
+    BodyArrays bodies;
+    bool eccentric = false;
+
+    // Central body at the orbit centre. GM is chosen so Kepler's third law gives
+    // the mean motions used when bodies are added.
+    float centralGM = 36.0f;
+    float centerX = 0.0f, centerY = 1.0f, centerZ = 0.0f;
+
+    // Barnes-Hut parameters
+    float theta = 0.7f;
+    float softening = 0.05f;
+    Octree octree;
+    std::vector<float> ax, ay, az;
+
+    // Bodies per parallel chunk; small populations stay on the calling thread
+    size_t minChunk = 4096;
+
+    void reserve(size_t count)
+    {
+        for (std::vector<float>* v : allArrays())
+            v->reserve(count);
+    }
+
+    void addBody(float semiMajor, float eccentricity, float meanMotion, float phase, float height, float mass)
+    {
+        eccentricity = std::min(std::max(eccentricity, 0.0f), 0.9f);
+        eccentric = eccentric || eccentricity > 0.0f;
+        bodies.semiMajor.push_back(semiMajor);
+        bodies.semiMinor.push_back(semiMajor * std::sqrt(1.0f - eccentricity * eccentricity));
+        bodies.eccentricity.push_back(eccentricity);
+        bodies.meanMotion.push_back(meanMotion);
+        bodies.phase.push_back(phase);
+        bodies.height.push_back(height);
+        bodies.mass.push_back(mass);
+
+        // Start on the orbit at t = 0 with the circular orbital velocity
+        float s = std::sin(phase), c = std::cos(phase);
+        bodies.x.push_back(semiMajor * s);
+        bodies.y.push_back(height);
+        bodies.z.push_back(semiMajor * c);
+        float speed = std::sqrt(centralGM / semiMajor);
+        bodies.vx.push_back(speed * c);
+        bodies.vy.push_back(0.0f);
+        bodies.vz.push_back(-speed * s);
+    }
+
+    void update(float time, float dt)
+    {
+        if (mode == SimulationKepler)
+            updateKepler(time);
+        else
+            stepGravity(dt);
+    }
+
+    void updateKepler(float time)
+    {
+        size_t count = bodies.size();
+        if (!pool)
+        {
+            keplerKernel(simdLevel, bodies, 0, count, time, eccentric);
+            return;
+        }
+        pool->parallelFor(count, minChunk, [&](size_t begin, size_t end) {
+            keplerKernel(simdLevel, bodies, begin, end, time, eccentric);
+        });
+    }
+
+    // Semi-implicit Euler step under the central body plus Barnes-Hut mutual gravity
+    void stepGravity(float dt)
+    {
+        size_t count = bodies.size();
+        if (count == 0 || dt <= 0.0f)
+            return;
+
+        octree.build(bodies);
+        ax.resize(count);
+        ay.resize(count);
+        az.resize(count);
+
+        auto integrate = [&](size_t begin, size_t end) {
+            computeAccelerations(begin, end);
+            for (size_t i = begin; i < end; ++i)
+            {
+                bodies.vx[i] += ax[i] * dt;
+                bodies.vy[i] += ay[i] * dt;
+                bodies.vz[i] += az[i] * dt;
+            }
+        };
+        if (pool)
+            pool->parallelFor(count, minChunk / 4, integrate);
+        else
+            integrate(0, count);
+
+        // Positions move only after every force has been evaluated against the same tree
+        for (size_t i = 0; i < count; ++i)
+        {
+            bodies.x[i] += bodies.vx[i] * dt;
+            bodies.y[i] += bodies.vy[i] * dt;
+            bodies.z[i] += bodies.vz[i] * dt;
+        }
+    }
+
+    void computeAccelerations(size_t begin, size_t end)
+    {
+        const float thetaSquared = theta * theta;
+        const float eps2 = softening * softening;
+        int stack[kOctreeMaxDepth * 8 + 8];
+
+        for (size_t i = begin; i < end; ++i)
+        {
+            float px = bodies.x[i], py = bodies.y[i], pz = bodies.z[i];
+
+            // Central body
+            float dx = centerX - px, dy = centerY - py, dz = centerZ - pz;
+            float r2 = dx * dx + dy * dy + dz * dz + eps2;
+            float inv = 1.0f / std::sqrt(r2);
+            float f = centralGM * inv * inv * inv;
+            float accX = f * dx, accY = f * dy, accZ = f * dz;
+
+            int top = 0;
+            stack[top++] = 0;
+            while (top > 0)
+            {
+                const OctreeNode& node = octree.nodes[stack[--top]];
+                dx = node.comX - px;
+                dy = node.comY - py;
+                dz = node.comZ - pz;
+                r2 = dx * dx + dy * dy + dz * dz + eps2;
+                float size = 2.0f * node.halfSize;
+
+                if (node.firstChild < 0)
+                {
+                    // Leaf: direct sum, skipping the body itself
+                    for (int k = node.firstBody; k < node.firstBody + node.bodyCount; ++k)
+                    {
+                        int j = octree.order[k];
+                        if ((size_t)j == i)
+                            continue;
+                        float ex = bodies.x[j] - px, ey = bodies.y[j] - py, ez = bodies.z[j] - pz;
+                        float d2 = ex * ex + ey * ey + ez * ez + eps2;
+                        float id = 1.0f / std::sqrt(d2);
+                        float g = bodies.mass[j] * id * id * id;
+                        accX += g * ex;
+                        accY += g * ey;
+                        accZ += g * ez;
+                    }
+                }
+                else if (size * size < thetaSquared * r2)
+                {
+                    // Far enough away to treat the whole cell as one mass
+                    inv = 1.0f / std::sqrt(r2);
+                    f = node.mass * inv * inv * inv;
+                    accX += f * dx;
+                    accY += f * dy;
+                    accZ += f * dz;
+                }
+                else
+                {
+                    for (int c = node.firstChild; c < node.firstChild + node.childCount; ++c)
+                        stack[top++] = c;
+                }
+            }
+            ax[i] = accX;
+            ay[i] = accY;
+            az[i] = accZ;
+        }
+    }
+
+    std::vector<std::vector<float>*> allArrays()
+    {
+        BodyArrays& b = bodies;
+        return { &b.semiMajor, &b.semiMinor, &b.eccentricity, &b.meanMotion, &b.phase, &b.height,
+                 &b.x, &b.y, &b.z, &b.vx, &b.vy, &b.vz, &b.mass };
+    }
+};
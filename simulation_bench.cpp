@@ -0,0 +1,102 @@
+// Standalone microbenchmark for the orbital simulation kernels. Needs no OpenGL:
+//
+//     g++ -O2 -pthread simulation_bench.cpp -o simulation_bench
+//     ./simulation_bench [bodies] [frames]
+//
+// Reports the time per update for the scalar, SSE2 and AVX2 Kepler kernels on
+// one thread and on the whole pool, plus a few Barnes-Hut gravity steps, and
+// checks the SIMD results against the scalar reference.
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#include "simulation.h"
+
+typedef std::chrono::steady_clock Clock;
+
+void fillBodies(OrbitalSimulation& sim, size_t count, bool eccentric)
+{
+    std::mt19937 rng(371);
+    std::uniform_real_distribution<float> radius(6.0f, 13.0f);
+    std::uniform_real_distribution<float> phase(0.0f, 6.2831853f);
+    std::uniform_real_distribution<float> height(0.6f, 1.4f);
+    std::uniform_real_distribution<float> ecc(0.0f, 0.2f);
+
+    sim.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        float a = radius(rng);
+        sim.addBody(a, eccentric ? ecc(rng) : 0.0f, std::sqrt(sim.centralGM / (a * a * a)), phase(rng), height(rng), 1e-7f);
+    }
+}
+
+double timeKepler(OrbitalSimulation& sim, int frames)
+{
+    sim.updateKepler(0.0f);
+    Clock::time_point start = Clock::now();
+    for (int frame = 0; frame < frames; ++frame)
+        sim.updateKepler(frame / 60.0f);
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count() / frames;
+}
+
+float maxError(const BodyArrays& a, const BodyArrays& b)
+{
+    float error = 0.0f;
+    for (size_t i = 0; i < a.size(); ++i)
+    {
+        error = std::max(error, std::fabs(a.x[i] - b.x[i]));
+        error = std::max(error, std::fabs(a.z[i] - b.z[i]));
+    }
+    return error;
+}
+
+int main(int argc, char** argv)
+{
+    size_t count = argc > 1 ? (size_t)atol(argv[1]) : 1000000;
+    int frames = argc > 2 ? atoi(argv[2]) : 50;
+
+    ThreadPool pool;
+    SimdLevel best = detectSimdLevel();
+    printf("%zu bodies, %d frames, %d threads, best SIMD %s\n", count, frames, pool.threadCount(), simdLevelName(best));
+
+    for (int eccentric = 0; eccentric <= 1; ++eccentric)
+    {
+        printf("\nKepler (%s orbits)\n", eccentric ? "eccentric" : "circular");
+        OrbitalSimulation reference;
+        fillBodies(reference, count, eccentric != 0);
+        reference.simdLevel = SimdScalar;
+        reference.updateKepler(12.5f);
+
+        for (int level = SimdScalar; level <= (int)best; ++level)
+        {
+            OrbitalSimulation sim;
+            fillBodies(sim, count, eccentric != 0);
+            sim.simdLevel = (SimdLevel)level;
+
+            double single = timeKepler(sim, frames);
+            sim.pool = &pool;
+            double threaded = timeKepler(sim, frames);
+            sim.updateKepler(12.5f);
+
+            printf("  %-7s 1 thread %8.3f ms (%6.2f ns/body)   %d threads %8.3f ms   max error %.2e\n",
+                   simdLevelName((SimdLevel)level), single, single * 1e6 / count, pool.threadCount(), threaded,
+                   maxError(sim.bodies, reference.bodies));
+        }
+    }
+
+    // Barnes-Hut is far more expensive per body, so a smaller population is used
+    size_t gravityCount = std::min<size_t>(count, 100000);
+    OrbitalSimulation gravity;
+    gravity.mode = SimulationGravity;
+    gravity.pool = &pool;
+    fillBodies(gravity, gravityCount, false);
+    int steps = std::max(1, frames / 10);
+    Clock::time_point start = Clock::now();
+    for (int step = 0; step < steps; ++step)
+        gravity.stepGravity(1.0f / 60.0f);
+    double gravityMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / steps;
+    printf("\nBarnes-Hut gravity: %zu bodies, %.3f ms/step, %zu octree nodes\n", gravityCount, gravityMs, gravity.octree.nodes.size());
+    return 0;
+}
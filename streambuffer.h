@@ -0,0 +1,162 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+// Ring buffer for data rewritten every frame (uniform blocks, instance arrays, light
+// lists). The GL buffer is split into kStreamFrames regions and each frame writes into
+// the next one: allocate() maps its range unsynchronized, so the caller fills it in
+// place, and endFrame() fences the region once the frame's draws are issued. By the
+// time a region comes round again its fence has normally signalled; if the GPU is
+// still behind, the buffer is orphaned rather than waited on, so the CPU never blocks.
+//
+// Like the renderer structs, a StreamBuffer is a plain bundle of handles: create() and
+// destroy() manage the GL objects. Allocations are only valid until the buffer grows,
+// which replaces its storage, so give each consumer its own stream and allocate once
+// per frame, or size the region for the whole frame up front.
+
+const int kStreamFrames = 3;
+
+struct StreamAllocation
+{
+    void* data = nullptr;    // mapped for writing until StreamBuffer::unmap()
+    GLintptr offset = 0;     // byte offset into StreamBuffer::buffer()
+    GLsizeiptr size = 0;
+};
+
+// Per-frame counters, reset by beginFrame()
+struct StreamStats
+{
+    size_t bytes = 0;
+    int allocations = 0;
+    int fenceWaits = 0;    // regions still in use by the GPU, handled by orphaning
+    int resizes = 0;
+};
+
+class StreamBuffer
+{
+public:
+    // regionBytes is the expected data per frame; alignment must be a power of two
+    void create(size_t regionBytes, size_t alignment = 16)
+    {
+        this->alignment = alignment;
+        glGenBuffers(1, &name);
+        reallocate(alignUp(regionBytes > 0 ? regionBytes : alignment));
+    }
+
+    void destroy()
+    {
+        unmap();
+        deleteFences();
+        glDeleteBuffers(1, &name);
+        name = 0;
+    }
+
+    GLuint buffer() const { return name; }
+    const StreamStats& stats() const { return frameStats; }
+
+    // Moves to the next region. Call once per frame before allocating.
+    void beginFrame()
+    {
+        frameStats = StreamStats();
+        region = (region + 1) % kStreamFrames;
+        used = 0;
+        if (fences[region])
+        {
+            GLenum status = glClientWaitSync(fences[region], 0, 0);
+            if (status == GL_TIMEOUT_EXPIRED)
+            {
+                ++frameStats.fenceWaits;
+                reallocate(regionSize);
+            }
+            else
+            {
+                glDeleteSync(fences[region]);
+                fences[region] = 0;
+            }
+        }
+    }
+
+    // Maps `size` bytes of this frame's region; the previous allocation is unmapped first
+    StreamAllocation allocate(size_t size)
+    {
+        unmap();
+        StreamAllocation allocation;
+        if (size == 0)
+            return allocation;
+        if (used + size > regionSize)
+        {
+            ++frameStats.resizes;
+            reallocate(alignUp(std::max(regionSize * 2, used + size)));
+        }
+
+        allocation.offset = (GLintptr)(region * regionSize + used);
+        allocation.size = (GLsizeiptr)size;
+        glBindBuffer(GL_COPY_WRITE_BUFFER, name);
+        allocation.data = glMapBufferRange(GL_COPY_WRITE_BUFFER, allocation.offset, allocation.size,
+                                           GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        mapped = allocation.data != nullptr;
+        used = alignUp(used + size);
+        frameStats.bytes += size;
+        ++frameStats.allocations;
+        return allocation;
+    }
+
+    // Ends CPU writes to the last allocation; required before the GPU reads it
+    void unmap()
+    {
+        if (!mapped)
+            return;
+        glBindBuffer(GL_COPY_WRITE_BUFFER, name);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        mapped = false;
+    }
+
+    // Fences the region after the frame's last draw that reads from it
+    void endFrame()
+    {
+        unmap();
+        if (used > 0)
+            fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+private:
+    size_t alignUp(size_t value) const
+    {
+        return (value + alignment - 1) & ~(alignment - 1);
+    }
+
+    // New storage for all regions; in-flight draws keep reading the old one
+    void reallocate(size_t newRegionSize)
+    {
+        unmap();
+        deleteFences();
+        regionSize = newRegionSize;
+        glBindBuffer(GL_COPY_WRITE_BUFFER, name);
+        glBufferData(GL_COPY_WRITE_BUFFER, regionSize * kStreamFrames, nullptr, GL_STREAM_DRAW);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    void deleteFences()
+    {
+        for (GLsync& fence : fences)
+        {
+            if (fence)
+                glDeleteSync(fence);
+            fence = 0;
+        }
+    }
+
+    GLuint name = 0;
+    size_t alignment = 16;
+    size_t regionSize = 0;
+    size_t used = 0;
+    int region = 0;
+    bool mapped = false;
+    GLsync fences[kStreamFrames] = {};
+    StreamStats frameStats;
+};
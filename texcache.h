@@ -0,0 +1,305 @@
+#pragma once
+
+#include <stb/stb_image.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+
+#include "hash.h"
+#include "mappedfile.h"
+
+// Cooked texture cache. The first time a source image is loaded it is decoded,
+// its full mip chain is box-filtered and optionally compressed to BC1, and the
+// result is written next to the source as "<source>.ctex". Later runs hash the
+// source, find a matching cooked file and mmap it, so no image is decoded and
+// no mipmaps are generated at startup.
+//
+// File layout: CookedTextureHeader, levelCount CookedLevel entries, then the
+// level data, each level starting on a 16-byte boundary.
+
+enum CookedFormat : uint32_t
+{
+    CookedRGB8 = 1,
+    CookedRGBA8 = 2,
+    CookedBC1 = 3
+};
+
+struct CookedTextureHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceHash;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t levelCount;
+};
+
+struct CookedLevel
+{
+    uint32_t width;
+    uint32_t height;
+    uint64_t offset;    // from the start of the file
+    uint64_t size;
+};
+
+const char kCookedMagic[4] = { 'C', 'T', 'E', 'X' };
+const uint32_t kCookedVersion = 1;
+
+// A cooked texture, either mapped from the cache or held in memory after cooking
+struct CookedTexture
+{
+    MappedFile file;
+    std::vector<unsigned char> memory;
+    const unsigned char* bytes = nullptr;
+    size_t size = 0;
+    bool fromCache = false;
+
+    const CookedTextureHeader& header() const { return *(const CookedTextureHeader*)bytes; }
+    const CookedLevel* levels() const { return (const CookedLevel*)(bytes + sizeof(CookedTextureHeader)); }
+};
+
+// Checks that a cooked file matches the source and that every level lies inside it
+inline bool validCookedTexture(const unsigned char* bytes, size_t size, uint64_t sourceHash, CookedFormat format)
+{
+    if (size < sizeof(CookedTextureHeader))
+        return false;
+    const CookedTextureHeader& header = *(const CookedTextureHeader*)bytes;
+    if (std::memcmp(header.magic, kCookedMagic, 4) != 0 || header.version != kCookedVersion ||
+        header.sourceHash != sourceHash || header.format != (uint32_t)format || header.levelCount == 0 ||
+        header.levelCount > 32 || size < sizeof(CookedTextureHeader) + header.levelCount * sizeof(CookedLevel))
+        return false;
+    const CookedLevel* levels = (const CookedLevel*)(bytes + sizeof(CookedTextureHeader));
+    for (uint32_t level = 0; level < header.levelCount; ++level)
+    {
+        if (levels[level].offset > size || levels[level].size > size - levels[level].offset)
+            return false;
+    }
+    return true;
+}
+
+// Full mip chain down to 1x1 with a 2x2 box filter; odd edges repeat their last texel
+inline std::vector<std::vector<unsigned char>> buildMipChain(const unsigned char* pixels, int width, int height, int channels)
+{
+    std::vector<std::vector<unsigned char>> levels(1, std::vector<unsigned char>(pixels, pixels + (size_t)width * height * channels));
+    while (width > 1 || height > 1)
+    {
+        int nextWidth = std::max(1, width / 2);
+        int nextHeight = std::max(1, height / 2);
+        const std::vector<unsigned char>& source = levels.back();
+        std::vector<unsigned char> next((size_t)nextWidth * nextHeight * channels);
+        for (int y = 0; y < nextHeight; ++y)
+        {
+            int y0 = std::min(height - 1, y * 2);
+            int y1 = std::min(height - 1, y * 2 + 1);
+            for (int x = 0; x < nextWidth; ++x)
+            {
+                int x0 = std::min(width - 1, x * 2);
+                int x1 = std::min(width - 1, x * 2 + 1);
+                for (int c = 0; c < channels; ++c)
+                {
+                    int sum = source[((size_t)y0 * width + x0) * channels + c] + source[((size_t)y0 * width + x1) * channels + c] +
+                              source[((size_t)y1 * width + x0) * channels + c] + source[((size_t)y1 * width + x1) * channels + c];
+                    next[((size_t)y * nextWidth + x) * channels + c] = (unsigned char)((sum + 2) / 4);
+                }
+            }
+        }
+        levels.push_back(std::move(next));
+        width = nextWidth;
+        height = nextHeight;
+    }
+    return levels;
+}
+
+inline uint16_t packRGB565(int r, int g, int b)
+{
+    return (uint16_t)(((r * 31 + 127) / 255) << 11 | ((g * 63 + 127) / 255) << 5 | ((b * 31 + 127) / 255));
+}
+
+inline void unpackRGB565(uint16_t c, int rgb[3])
+{
+    rgb[0] = ((c >> 11) & 31) * 255 / 31;
+    rgb[1] = ((c >> 5) & 63) * 255 / 63;
+    rgb[2] = (c & 31) * 255 / 31;
+}
+
+// BC1 (DXT1) in opaque four-colour mode. Endpoints are the block's extremes along
+// its widest colour axis; texels pick the nearest of the four palette entries.
+inline std::vector<unsigned char> encodeBC1(const unsigned char* pixels, int width, int height, int channels)
+{
+    int blocksX = (width + 3) / 4;
+    int blocksY = (height + 3) / 4;
+    std::vector<unsigned char> blocks((size_t)blocksX * blocksY * 8);
+    for (int by = 0; by < blocksY; ++by)
+    {
+        for (int bx = 0; bx < blocksX; ++bx)
+        {
+            int texels[16][3];
+            int low[3] = { 255, 255, 255 }, high[3] = { 0, 0, 0 };
+            for (int i = 0; i < 16; ++i)
+            {
+                int x = std::min(width - 1, bx * 4 + i % 4);
+                int y = std::min(height - 1, by * 4 + i / 4);
+                const unsigned char* p = &pixels[((size_t)y * width + x) * channels];
+                for (int c = 0; c < 3; ++c)
+                {
+                    texels[i][c] = p[c];
+                    low[c] = std::min(low[c], (int)p[c]);
+                    high[c] = std::max(high[c], (int)p[c]);
+                }
+            }
+
+            int axis = 0;
+            for (int c = 1; c < 3; ++c)
+            {
+                if (high[c] - low[c] > high[axis] - low[axis])
+                    axis = c;
+            }
+            int minIndex = 0, maxIndex = 0;
+            for (int i = 1; i < 16; ++i)
+            {
+                if (texels[i][axis] < texels[minIndex][axis])
+                    minIndex = i;
+                if (texels[i][axis] > texels[maxIndex][axis])
+                    maxIndex = i;
+            }
+
+            uint16_t color0 = packRGB565(texels[maxIndex][0], texels[maxIndex][1], texels[maxIndex][2]);
+            uint16_t color1 = packRGB565(texels[minIndex][0], texels[minIndex][1], texels[minIndex][2]);
+            if (color0 < color1)
+                std::swap(color0, color1);
+
+            uint32_t indices = 0;
+            if (color0 != color1)
+            {
+                int palette[4][3];
+                unpackRGB565(color0, palette[0]);
+                unpackRGB565(color1, palette[1]);
+                for (int c = 0; c < 3; ++c)
+                {
+                    palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+                    palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+                }
+                for (int i = 0; i < 16; ++i)
+                {
+                    int best = 0, bestDistance = INT32_MAX;
+                    for (int k = 0; k < 4; ++k)
+                    {
+                        int dr = texels[i][0] - palette[k][0], dg = texels[i][1] - palette[k][1], db = texels[i][2] - palette[k][2];
+                        int distance = dr * dr + dg * dg + db * db;
+                        if (distance < bestDistance)
+                        {
+                            bestDistance = distance;
+                            best = k;
+                        }
+                    }
+                    indices |= (uint32_t)best << (i * 2);
+                }
+            }
+
+            unsigned char* block = &blocks[((size_t)by * blocksX + bx) * 8];
+            std::memcpy(block, &color0, 2);
+            std::memcpy(block + 2, &color1, 2);
+            std::memcpy(block + 4, &indices, 4);
+        }
+    }
+    return blocks;
+}
+
+// Builds the cooked file contents for decoded pixels (3 or 4 channels)
+inline std::vector<unsigned char> cookTexture(const unsigned char* pixels, int width, int height, int channels,
+                                              CookedFormat format, uint64_t sourceHash)
+{
+    std::vector<std::vector<unsigned char>> mips = buildMipChain(pixels, width, height, channels);
+    if (format == CookedBC1)
+    {
+        int levelWidth = width, levelHeight = height;
+        for (std::vector<unsigned char>& level : mips)
+        {
+            level = encodeBC1(level.data(), levelWidth, levelHeight, channels);
+            levelWidth = std::max(1, levelWidth / 2);
+            levelHeight = std::max(1, levelHeight / 2);
+        }
+    }
+
+    CookedTextureHeader header;
+    std::memcpy(header.magic, kCookedMagic, 4);
+    header.version = kCookedVersion;
+    header.sourceHash = sourceHash;
+    header.format = format;
+    header.width = width;
+    header.height = height;
+    header.levelCount = (uint32_t)mips.size();
+
+    std::vector<CookedLevel> levels(mips.size());
+    size_t offset = sizeof(CookedTextureHeader) + levels.size() * sizeof(CookedLevel);
+    for (size_t level = 0; level < mips.size(); ++level)
+    {
+        offset = (offset + 15) & ~(size_t)15;
+        levels[level].width = std::max(1, width >> level);
+        levels[level].height = std::max(1, height >> level);
+        levels[level].offset = offset;
+        levels[level].size = mips[level].size();
+        offset += mips[level].size();
+    }
+
+    std::vector<unsigned char> bytes(offset, 0);
+    std::memcpy(bytes.data(), &header, sizeof(header));
+    std::memcpy(bytes.data() + sizeof(header), levels.data(), levels.size() * sizeof(CookedLevel));
+    for (size_t level = 0; level < mips.size(); ++level)
+        std::memcpy(bytes.data() + levels[level].offset, mips[level].data(), mips[level].size());
+    return bytes;
+}
+
+// Loads a source image through the cache: maps "<path>.ctex" when it was cooked from
+// the same source bytes in the same format, otherwise decodes and cooks the source
+// and writes the cache file (through a rename, so concurrent runs never see half a
+// file). A cache that cannot be written only costs the next run another cook.
+inline bool loadCookedTexture(const std::string& path, CookedFormat rgbFormat, CookedTexture& texture)
+{
+    std::vector<unsigned char> source;
+    if (!readFile(path, source))
+        return false;
+    uint64_t hash = hashBytes(source.data(), source.size());
+
+    // Alpha is only ever kept uncompressed
+    int width, height, channels;
+    bool hasAlpha = stbi_info_from_memory(source.data(), (int)source.size(), &width, &height, &channels) && channels == 4;
+    CookedFormat format = hasAlpha ? CookedRGBA8 : rgbFormat;
+
+    std::string cachePath = path + ".ctex";
+    if (texture.file.open(cachePath) && validCookedTexture(texture.file.data(), texture.file.size(), hash, format))
+    {
+        texture.bytes = texture.file.data();
+        texture.size = texture.file.size();
+        texture.fromCache = true;
+        return true;
+    }
+    texture.file.close();
+
+    channels = hasAlpha ? 4 : 3;
+    unsigned char* pixels = stbi_load_from_memory(source.data(), (int)source.size(), &width, &height, &channels, hasAlpha ? 4 : 3);
+    if (!pixels)
+        return false;
+    texture.memory = cookTexture(pixels, width, height, hasAlpha ? 4 : 3, format, hash);
+    stbi_image_free(pixels);
+    texture.bytes = texture.memory.data();
+    texture.size = texture.memory.size();
+    texture.fromCache = false;
+
+    std::string temporaryPath = cachePath + ".tmp" + std::to_string((long)getpid());
+    FILE* file = fopen(temporaryPath.c_str(), "wb");
+    if (file)
+    {
+        bool written = fwrite(texture.memory.data(), 1, texture.memory.size(), file) == texture.memory.size();
+        written = fclose(file) == 0 && written;
+        if (!written || rename(temporaryPath.c_str(), cachePath.c_str()) != 0)
+            remove(temporaryPath.c_str());
+    }
+    return true;
+}
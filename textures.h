@@ -0,0 +1,266 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "profiler.h"
+#include "threadpool.h"
+#include "texcache.h"
+
+// Asynchronous texture loading. request() returns a handle straight away and queues
+// the file on the thread pool, which maps its cooked version from the texture cache
+// (cooking it on first use); update() uploads finished textures level by level on the
+// GL thread through a pixel buffer object. Until a texture arrives get() returns a
+// shared 1x1 placeholder, and once a file has failed to load it returns 0 so the
+// object falls back to its flat colour.
+
+// Bytes uploaded per update() call; at least one image is always uploaded
+const size_t kTextureUploadBudget = 8 << 20;
+
+class TextureManager
+{
+public:
+    // Opaque textures are cooked to BC1 when `compress` is set and the driver supports it
+    TextureManager(ThreadPool& pool, bool compress) : pool(pool)
+    {
+        rgbFormat = compress && GLEW_EXT_texture_compression_s3tc ? CookedBC1 : CookedRGB8;
+        const unsigned char grey[] = { 128, 128, 128, 255 };
+        glGenTextures(1, &placeholder);
+        glBindTexture(GL_TEXTURE_2D, placeholder);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glGenBuffers(1, &uploadBuffer);
+    }
+
+    // Waits for decodes still running on the pool, which write into this object
+    ~TextureManager()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        decodedReady.wait(lock, [this] { return decoding == 0; });
+    }
+
+    TextureManager(const TextureManager&) = delete;
+    TextureManager& operator=(const TextureManager&) = delete;
+
+    // Returns the handle for a file, starting the load on first request
+    int request(const std::string& path)
+    {
+        auto found = handles.find(path);
+        if (found != handles.end())
+            return found->second;
+
+        if (pending() == 0)
+            loadStart = Clock::now();
+        int handle = (int)entries.size();
+        entries.push_back(Entry());
+        handles[path] = handle;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++decoding;
+        }
+        pool.submit([this, handle, path] { decode(handle, path); });
+        return handle;
+    }
+
+    // Texture to bind for a handle; -1 means no texture
+    GLuint get(int handle) const
+    {
+        if (handle < 0)
+            return 0;
+        const Entry& entry = entries[handle];
+        if (entry.failed)
+            return 0;
+        return entry.texture ? entry.texture : placeholder;
+    }
+
+    // Uploads decoded images, up to `budget` bytes. Call on the GL thread once per frame.
+    void update(size_t budget = kTextureUploadBudget)
+    {
+        size_t uploaded = 0;
+        for (;;)
+        {
+            Decoded image;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (decoded.empty())
+                    break;
+                size_t size = decoded.front().texture.size;
+                if (uploaded > 0 && uploaded + size > budget)
+                    break;
+                image = std::move(decoded.front());
+                decoded.pop_front();
+                uploaded += size;
+            }
+            upload(image);
+        }
+    }
+
+    // Blocks until every requested texture has been decoded and uploaded
+    void finish()
+    {
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                decodedReady.wait(lock, [this] { return decoding == 0 || !decoded.empty(); });
+                if (decoding == 0 && decoded.empty())
+                    return;
+            }
+            update(SIZE_MAX);
+        }
+    }
+
+    // Requests that have not been uploaded or failed yet
+    int pending() const
+    {
+        return (int)entries.size() - completed;
+    }
+
+    // Time from the first request until the last texture was uploaded
+    double loadMilliseconds() const
+    {
+        return std::chrono::duration<double, std::milli>(loadEnd - loadStart).count();
+    }
+
+    int cachedCount() const { return cached; }
+    int cookedCount() const { return cooked; }
+
+    // Texel data uploaded so far, over all mip levels
+    size_t textureBytes() const { return uploadedBytes; }
+
+    // Deletes the GL objects; call while the context is still current
+    void release()
+    {
+        for (Entry& entry : entries)
+            glDeleteTextures(1, &entry.texture);
+        glDeleteTextures(1, &placeholder);
+        glDeleteBuffers(1, &uploadBuffer);
+        entries.clear();
+        handles.clear();
+        completed = 0;
+        placeholder = 0;
+        uploadBuffer = 0;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Entry
+    {
+        GLuint texture = 0;
+        bool failed = false;
+    };
+
+    struct Decoded
+    {
+        int handle = -1;
+        bool loaded = false;
+        CookedTexture texture;
+    };
+
+    // Runs on a pool thread
+    void decode(int handle, const std::string& path)
+    {
+        ProfileZone zone("textures.decode");
+        Decoded image;
+        image.handle = handle;
+        image.loaded = loadCookedTexture(path, rgbFormat, image.texture);
+        if (!image.loaded)
+            std::cerr << "Failed to load texture: " << path << std::endl;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        decoded.push_back(std::move(image));
+        --decoding;
+        decodedReady.notify_all();
+    }
+
+    void upload(const Decoded& image)
+    {
+        Entry& entry = entries[image.handle];
+        ++completed;
+        if (completed == (int)entries.size())
+            loadEnd = Clock::now();
+        if (!image.loaded)
+        {
+            entry.failed = true;
+            return;
+        }
+        const CookedTexture& texture = image.texture;
+        ++(texture.fromCache ? cached : cooked);
+
+        // Stage the whole file through an orphaned PBO so the level uploads can return
+        // before the copy is done; level offsets are then offsets into the PBO
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploadBuffer);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, texture.size, nullptr, GL_STREAM_DRAW);
+        const unsigned char* source = nullptr;
+        void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, texture.size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (mapped)
+        {
+            std::memcpy(mapped, texture.bytes, texture.size);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+        else
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            source = texture.bytes;
+        }
+
+        const CookedTextureHeader& header = texture.header();
+        const CookedLevel* levels = texture.levels();
+        glGenTextures(1, &entry.texture);
+        glBindTexture(GL_TEXTURE_2D, entry.texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)header.levelCount - 1);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (uint32_t level = 0; level < header.levelCount; ++level)
+        {
+            const CookedLevel& info = levels[level];
+            const void* data = source + info.offset;
+            if (header.format == CookedBC1)
+                glCompressedTexImage2D(GL_TEXTURE_2D, level, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, info.width, info.height, 0,
+                                       (GLsizei)info.size, data);
+            else if (header.format == CookedRGBA8)
+                glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, info.width, info.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+            else
+                glTexImage2D(GL_TEXTURE_2D, level, GL_RGB8, info.width, info.height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+            uploadedBytes += info.size;
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    ThreadPool& pool;
+    GLuint placeholder = 0;
+    GLuint uploadBuffer = 0;
+    std::vector<Entry> entries;
+    std::unordered_map<std::string, int> handles;
+    CookedFormat rgbFormat = CookedRGB8;
+    int completed = 0;
+    int cached = 0;
+    int cooked = 0;
+    size_t uploadedBytes = 0;
+    Clock::time_point loadStart;
+    Clock::time_point loadEnd;
+
+    // Shared with the decode tasks
+    std::mutex mutex;
+    std::condition_variable decodedReady;
+    std::deque<Decoded> decoded;
+    int decoding = 0;
+};
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for data-parallel loops. parallelFor() splits
+// [0, count) into chunks that workers (and the calling thread) claim through an
+// atomic counter, and returns once every chunk has run. submit() queues
+// fire-and-forget tasks that idle workers pick up between parallel loops; a worker
+// busy with a task joins a loop late or not at all, and the loop never waits for it.
+// Loops started from different threads (render and simulation) run one after the other.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(int threadCount = 0)
+    {
+        if (threadCount <= 0)
+            threadCount = (int)std::max(1u, std::thread::hardware_concurrency());
+        // The caller works too, so one thread fewer is spawned
+        for (int i = 1; i < threadCount; ++i)
+            workers.emplace_back([this] { workerLoop(); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int threadCount() const { return (int)workers.size() + 1; }
+
+    // Runs fn(begin, end) over [0, count) in chunks of at least minChunk items
+    void parallelFor(size_t count, size_t minChunk, const std::function<void(size_t, size_t)>& fn)
+    {
+        if (count == 0)
+            return;
+        size_t chunk = std::max(minChunk, (count + threadCount() * 4 - 1) / (threadCount() * 4));
+        if (workers.empty() || count <= chunk)
+        {
+            fn(0, count);
+            return;
+        }
+
+        std::lock_guard<std::mutex> loopLock(loopMutex);
+        std::unique_lock<std::mutex> lock(mutex);
+        job = &fn;
+        jobCount = count;
+        jobChunk = chunk;
+        nextIndex.store(0);
+        activeWorkers = 0;
+        ++generation;
+        lock.unlock();
+        wake.notify_all();
+
+        runChunks();
+
+        // Every chunk is claimed now; only workers still running one are waited for
+        lock.lock();
+        done.wait(lock, [this] { return activeWorkers == 0; });
+        job = nullptr;
+    }
+
+    // Queues a task for the next idle worker. Pools without workers run it immediately.
+    // Tasks still queued when the pool is destroyed are dropped.
+    void submit(std::function<void()> task)
+    {
+        if (workers.empty())
+        {
+            task();
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+        wake.notify_one();
+    }
+
+private:
+    void runChunks()
+    {
+        for (;;)
+        {
+            size_t begin = nextIndex.fetch_add(jobChunk);
+            if (begin >= jobCount)
+                break;
+            (*job)(begin, std::min(jobCount, begin + jobChunk));
+        }
+    }
+
+    void workerLoop()
+    {
+        unsigned int seenGeneration = 0;
+        for (;;)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seenGeneration || !tasks.empty(); });
+            if (stopping)
+                return;
+
+            // Parallel loops take priority over queued tasks
+            if (generation != seenGeneration)
+            {
+                seenGeneration = generation;
+                // Back from a task after the loop already returned
+                if (!job)
+                    continue;
+                ++activeWorkers;
+                lock.unlock();
+
+                runChunks();
+
+                lock.lock();
+                if (--activeWorkers == 0)
+                    done.notify_one();
+                continue;
+            }
+
+            std::function<void()> task = std::move(tasks.front());
+            tasks.pop_front();
+            lock.unlock();
+            task();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex loopMutex;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    bool stopping = false;
+    unsigned int generation = 0;
+    int activeWorkers = 0;    // workers inside the current loop
+    std::deque<std::function<void()>> tasks;
+
+    const std::function<void(size_t, size_t)>* job = nullptr;
+    size_t jobCount = 0;
+    size_t jobChunk = 0;
+    std::atomic<size_t> nextIndex{ 0 };
+};